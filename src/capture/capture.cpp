@@ -0,0 +1,333 @@
+#include "capture/capture.h"
+
+#include <log/log.h>
+#include <video/video.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace Capture
+{
+
+using Video::DISPLAY_HEIGHT;
+using Video::DISPLAY_WIDTH;
+
+constexpr static int FRAME_PIXELS = DISPLAY_WIDTH * DISPLAY_HEIGHT;
+
+//One frame is pushed for every frame the emulator is timed to run
+constexpr static int FRAME_RATE = 60;
+
+//Both queues are sized to powers of two, so their free-running counters stay correct when they wrap around
+//8 frames is about 1MB, and 2^17 samples is over a second of stereo audio at 48kHz
+constexpr static uint32_t FRAME_SLOTS = 8;
+constexpr static uint32_t AUDIO_QUEUE_SIZE = 1 << 17;
+
+//How long the writer sleeps when both queues are empty
+constexpr static auto WRITER_IDLE_TIME = std::chrono::milliseconds(2);
+
+constexpr static int WAV_HEADER_SIZE = 44;
+
+static std::atomic<bool> active;
+static std::thread writer;
+
+static std::ofstream video_file;
+static std::ofstream audio_file;
+static int audio_sample_rate;
+
+//Single producer, single consumer queues. The producer only moves the head and the consumer only moves the tail.
+static std::unique_ptr<uint16_t[]> frames;
+static std::atomic<uint32_t> frame_head;
+static std::atomic<uint32_t> frame_tail;
+
+//Repeats of the previous frame to write before each queued one, and ones still to be attached to the next frame
+static uint32_t frame_repeats[FRAME_SLOTS];
+static std::atomic<uint32_t> pending_repeats;
+static std::atomic<bool> audio_paused;
+
+static std::unique_ptr<float[]> audio;
+static std::atomic<uint32_t> audio_head;
+static std::atomic<uint32_t> audio_tail;
+
+static std::atomic<uint64_t> frames_written;
+static std::atomic<uint64_t> frames_repeated;
+static std::atomic<uint64_t> samples_written;
+static std::atomic<uint64_t> samples_dropped;
+
+static void write_u32(std::ofstream& file, uint32_t value)
+{
+	file.write((char*)&value, 4);
+}
+
+static void write_u16(std::ofstream& file, uint16_t value)
+{
+	file.write((char*)&value, 2);
+}
+
+//16-bit PCM stereo. It's written with a size of zero to start with, then again by stop() once the size is known.
+static void write_wav_header(std::ofstream& file, uint32_t data_size)
+{
+	file.write("RIFF", 4);
+	write_u32(file, data_size + WAV_HEADER_SIZE - 8);
+	file.write("WAVE", 4);
+
+	file.write("fmt ", 4);
+	write_u32(file, 16);
+	write_u16(file, 1);
+	write_u16(file, 2);
+	write_u32(file, audio_sample_rate);
+	write_u32(file, audio_sample_rate * 2 * sizeof(int16_t));
+	write_u16(file, 2 * sizeof(int16_t));
+	write_u16(file, 16);
+
+	file.write("data", 4);
+	write_u32(file, data_size);
+}
+
+//Converts to full-resolution YCbCr (BT.601, limited range), so the video isn't chroma subsampled
+static void write_frame(const uint16_t* pixels, std::vector<uint8_t>& planes)
+{
+	uint8_t* y_plane = planes.data();
+	uint8_t* u_plane = y_plane + FRAME_PIXELS;
+	uint8_t* v_plane = u_plane + FRAME_PIXELS;
+
+	for (int i = 0; i < FRAME_PIXELS; i++)
+	{
+		int r = (pixels[i] >> 10) & 0x1F;
+		int g = (pixels[i] >> 5) & 0x1F;
+		int b = pixels[i] & 0x1F;
+		r = (r << 3) | (r >> 2);
+		g = (g << 3) | (g >> 2);
+		b = (b << 3) | (b >> 2);
+
+		y_plane[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+		u_plane[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+		v_plane[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+	}
+
+	video_file.write("FRAME\n", 6);
+	video_file.write((char*)planes.data(), planes.size());
+	frames_written++;
+}
+
+//The planes still hold the last frame converted, or black if there wasn't one
+static void write_repeats(uint32_t count, const std::vector<uint8_t>& planes)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		video_file.write("FRAME\n", 6);
+		video_file.write((char*)planes.data(), planes.size());
+	}
+	frames_written += count;
+	frames_repeated += count;
+}
+
+//Writes every queued frame, returning whether there were any
+static bool drain_frames(std::vector<uint8_t>& planes)
+{
+	uint32_t tail = frame_tail.load(std::memory_order_relaxed);
+	uint32_t head = frame_head.load(std::memory_order_acquire);
+	if (tail == head)
+	{
+		return false;
+	}
+
+	//Each slot is handed back as soon as it's written, so the producer can reuse it while the rest are converted
+	for (; tail != head; tail++)
+	{
+		write_repeats(frame_repeats[tail % FRAME_SLOTS], planes);
+		write_frame(&frames[(tail % FRAME_SLOTS) * FRAME_PIXELS], planes);
+		frame_tail.store(tail + 1, std::memory_order_release);
+	}
+	return true;
+}
+
+//Writes every queued sample as 16-bit PCM, returning whether there were any
+static bool drain_audio(std::vector<int16_t>& pcm)
+{
+	uint32_t tail = audio_tail.load(std::memory_order_relaxed);
+	uint32_t head = audio_head.load(std::memory_order_acquire);
+	uint32_t count = head - tail;
+	if (!count)
+	{
+		return false;
+	}
+
+	pcm.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		float sample = std::clamp(audio[(tail + i) % AUDIO_QUEUE_SIZE], -1.0f, 1.0f);
+		pcm[i] = (int16_t)(sample * 32767.0f);
+	}
+	audio_tail.store(head, std::memory_order_release);
+
+	audio_file.write((char*)pcm.data(), count * sizeof(int16_t));
+	samples_written += count;
+	return true;
+}
+
+static void writer_thread()
+{
+	std::vector<uint8_t> planes(FRAME_PIXELS * 3, 128);
+	std::fill_n(planes.begin(), FRAME_PIXELS, 16);
+	std::vector<int16_t> pcm;
+
+	while (true)
+	{
+		//Checked before draining, so everything queued before stop() is still written
+		bool stopping = !active.load();
+
+		bool wrote = drain_frames(planes);
+		wrote |= drain_audio(pcm);
+
+		if (!wrote)
+		{
+			if (stopping)
+			{
+				//Slots skipped after the last queued frame still count
+				write_repeats(pending_repeats.exchange(0), planes);
+				return;
+			}
+			std::this_thread::sleep_for(WRITER_IDLE_TIME);
+		}
+	}
+}
+
+bool start(fs::path base_path, int sample_rate)
+{
+	if (active)
+	{
+		return false;
+	}
+
+	fs::path video_path = base_path;
+	video_path += ".y4m";
+	fs::path audio_path = base_path;
+	audio_path += ".wav";
+
+	video_file.open(video_path, std::ios::binary);
+	audio_file.open(audio_path, std::ios::binary);
+	if (!video_file.is_open() || !audio_file.is_open())
+	{
+		Log::error("[Capture] could not open %s for writing", base_path.string().c_str());
+		video_file.close();
+		audio_file.close();
+		return false;
+	}
+
+	//The Loopy's pixels aren't square, so the aspect ratio is left unknown
+	video_file << "YUV4MPEG2 W" << DISPLAY_WIDTH << " H" << DISPLAY_HEIGHT << " F" << FRAME_RATE << ":1 Ip A0:0 C444\n";
+	audio_sample_rate = sample_rate;
+	write_wav_header(audio_file, 0);
+
+	frames = std::make_unique<uint16_t[]>(FRAME_SLOTS * FRAME_PIXELS);
+	audio = std::make_unique<float[]>(AUDIO_QUEUE_SIZE);
+	frame_head = frame_tail = 0;
+	audio_head = audio_tail = 0;
+	pending_repeats = 0;
+	audio_paused = false;
+	frames_written = frames_repeated = 0;
+	samples_written = samples_dropped = 0;
+
+	active = true;
+	writer = std::thread(writer_thread);
+	Log::info("[Capture] recording to %s", base_path.string().c_str());
+	return true;
+}
+
+void stop()
+{
+	if (!active)
+	{
+		return;
+	}
+
+	active = false;
+	writer.join();
+
+	//Fill in the sizes now that the length is known
+	uint64_t data_size = samples_written * sizeof(int16_t);
+	audio_file.seekp(0);
+	write_wav_header(audio_file, (uint32_t)std::min<uint64_t>(data_size, UINT32_MAX - WAV_HEADER_SIZE));
+
+	video_file.close();
+	audio_file.close();
+	frames = nullptr;
+	audio = nullptr;
+
+	Log::info("[Capture] stopped: %llu frames (%llu repeated), %llu samples (%llu dropped)",
+			  (unsigned long long)frames_written, (unsigned long long)frames_repeated,
+			  (unsigned long long)samples_written, (unsigned long long)samples_dropped);
+
+	//These should be within a frame or so of each other, or the two files will drift apart when played together
+	double video_seconds = (double)frames_written / FRAME_RATE;
+	double audio_seconds = samples_written / (2.0 * audio_sample_rate);
+	Log::info("[Capture] %.2fs of video, %.2fs of audio", video_seconds, audio_seconds);
+}
+
+bool is_active()
+{
+	return active;
+}
+
+void push_frame(const uint16_t* pixels)
+{
+	if (!active)
+	{
+		return;
+	}
+
+	uint32_t head = frame_head.load(std::memory_order_relaxed);
+	if (head - frame_tail.load(std::memory_order_acquire) == FRAME_SLOTS)
+	{
+		pending_repeats++;
+		return;
+	}
+
+	frame_repeats[head % FRAME_SLOTS] = pending_repeats.exchange(0);
+	memcpy(&frames[(head % FRAME_SLOTS) * FRAME_PIXELS], pixels, FRAME_PIXELS * sizeof(uint16_t));
+	frame_head.store(head + 1, std::memory_order_release);
+}
+
+void repeat_frames(uint32_t count)
+{
+	if (active)
+	{
+		pending_repeats += count;
+	}
+}
+
+void set_paused(bool paused)
+{
+	audio_paused = paused;
+}
+
+void push_audio(const float* samples, uint32_t count)
+{
+	if (!active || audio_paused)
+	{
+		return;
+	}
+
+	//A buffer that doesn't fit is dropped whole, so the channels stay interleaved in order
+	uint32_t head = audio_head.load(std::memory_order_relaxed);
+	uint32_t free_space = AUDIO_QUEUE_SIZE - (head - audio_tail.load(std::memory_order_acquire));
+	if (count > free_space)
+	{
+		samples_dropped += count;
+		return;
+	}
+
+	uint32_t start = head % AUDIO_QUEUE_SIZE;
+	uint32_t first = std::min(count, AUDIO_QUEUE_SIZE - start);
+	memcpy(&audio[start], samples, first * sizeof(float));
+	memcpy(&audio[0], samples + first, (count - first) * sizeof(float));
+	audio_head.store(head + count, std::memory_order_release);
+}
+
+}  // namespace Capture
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace Capture
+{
+
+/*
+ * Records video to <base>.y4m and audio to <base>.wav. Frames and samples are queued in fixed-size lock-free buffers
+ * and written by a background thread, so recording never waits for the disk. A frame that doesn't fit because the
+ * writer fell behind is replaced by a repeat of the last one, so the video keeps time with the audio. Samples that
+ * don't fit are dropped and counted.
+ */
+bool start(fs::path base_path, int sample_rate);
+bool is_active();
+
+//Finishes writing what's queued and closes the files. Nothing may push while this runs, so an audio thread pushing
+//samples has to be stopped or disconnected first.
+void stop();
+
+//Queues a full DISPLAY_WIDTH x DISPLAY_HEIGHT frame of RGB555 display output. Only call from one thread.
+void push_frame(const uint16_t* pixels);
+
+//Repeats the last frame for frame slots the emulator skipped while audio went on. Call from the push_frame thread.
+void repeat_frames(uint32_t count);
+
+//Audio pushed while paused is ignored, as no frames are pushed to go with it
+void set_paused(bool paused);
+
+//Queues interleaved stereo samples. Only call from one thread, which may be the audio thread.
+void push_audio(const float* samples, uint32_t count);
+
+}  // namespace Capture
@@ -28,6 +28,23 @@ struct EmulatorOpts
 	int screenshot_image_type;
 	int printer_image_type;
 	std::string printer_view_command;
+
+	//Draw visible lines on a worker thread while emulation continues
+	bool threaded_render = false;
+
+	//Threads drawing each frame in bands at VSYNC, 0 draws lines as they end
+	int deferred_render_threads = 0;
+
+	//Run timing domains such as the sound synth on their own threads, up to this many cycles apart from the CPU
+	bool threaded_timing = false;
+	int64_t timing_max_skew = 0;
+
+	//Register, palette, OAM and DMA writes kept in the VDP write log, 0 to not log them
+	int write_log_size = 0;
+
+	//Record resolved input actions to a file, or replay them from one instead of taking live input
+	fs::path input_record_path;
+	fs::path input_playback_path;
 };
 
 struct SystemInfo
@@ -14,6 +14,7 @@ constexpr static int SH2_REGION_SIZE = 1 << 24;
 struct State
 {
 	std::vector<uint8_t*> sh2_pagetable;
+	std::vector<uint8_t*> sh2_write_pagetable;
 
 	uint8_t bios[BIOS_SIZE];
 	uint8_t ram[RAM_SIZE];
@@ -28,7 +29,7 @@ static void map_pagetable(std::vector<uint8_t*>& table, uint8_t* data, uint32_t
 
 	for (unsigned int i = 0; i < size; i++)
 	{
-		table[start + i] = data + (i << 12);
+		table[start + i] = data ? data + (i << 12) : nullptr;
 	}
 }
 
@@ -40,6 +41,8 @@ void initialize(std::vector<uint8_t>& bios_rom)
 
 	state->sh2_pagetable.resize(SH2_PAGETABLE_SIZE);
 	std::fill(state->sh2_pagetable.begin(), state->sh2_pagetable.end(), nullptr);
+	state->sh2_write_pagetable.resize(SH2_PAGETABLE_SIZE);
+	std::fill(state->sh2_write_pagetable.begin(), state->sh2_write_pagetable.end(), nullptr);
 
 	map_sh2_pagetable(state->bios, BIOS_START, BIOS_SIZE);
 
@@ -60,6 +63,7 @@ void shutdown()
 void map_sh2_pagetable(uint8_t* data, uint32_t start, uint32_t size)
 {
 	map_pagetable(state->sh2_pagetable, data, start, size);
+	map_pagetable(state->sh2_write_pagetable, data, start, size);
 }
 
 uint8_t** get_sh2_pagetable()
@@ -67,4 +71,15 @@ uint8_t** get_sh2_pagetable()
 	return state->sh2_pagetable.data();
 }
 
+void map_sh2_pagetable_read_only(uint8_t* data, uint32_t start, uint32_t size)
+{
+	map_pagetable(state->sh2_pagetable, data, start, size);
+	map_pagetable(state->sh2_write_pagetable, nullptr, start, size);
+}
+
+uint8_t** get_sh2_write_pagetable()
+{
+	return state->sh2_write_pagetable.data();
+}
+
 }
\ No newline at end of file
@@ -19,4 +19,8 @@ void shutdown();
 void map_sh2_pagetable(uint8_t* data, uint32_t start, uint32_t size);
 uint8_t** get_sh2_pagetable();
 
+//Read-only pages are read directly, but writes go through MMIO so the owner can track them
+void map_sh2_pagetable_read_only(uint8_t* data, uint32_t start, uint32_t size);
+uint8_t** get_sh2_write_pagetable();
+
 }
\ No newline at end of file
@@ -16,6 +16,11 @@ constexpr static int TIMER_COUNT = 5;
 
 static Timing::FuncHandle ev_func;
 
+/*
+ * Counters and flags aren't stepped by events. They're derived from the time elapsed since the last sync, which is
+ * done whenever a register is accessed. A scheduler event is only needed when an enabled interrupt has to be raised
+ * on time, so free-running timers used as time bases cost nothing until they're read.
+ */
 struct Timer
 {
 	Timing::EventHandle ev;
@@ -36,62 +41,178 @@ struct Timer
 	int intr_flag;
 
 	uint32_t counter;
-	uint32_t counter_when_started;
 	uint32_t gen_reg[2];
 
-	int64_t time_when_started;
+	//Timestamp of the last whole counter tick, so partial ticks carry over to the next sync
+	int64_t last_sync;
 
-	void update_counter()
+	constexpr static uint32_t OVERFLOW_TARGET = 0x10000;
+
+	uint32_t next_target(uint32_t value)
 	{
-		if (!ev.is_valid())
+		//Calculate the target which will take the smallest amount of time to reach
+		uint32_t nearest_target = OVERFLOW_TARGET;
+		for (int i = 0; i < 2; i++)
 		{
-			return;
+			if (value < gen_reg[i])
+			{
+				nearest_target = std::min(nearest_target, gen_reg[i]);
+			}
 		}
+		return nearest_target;
+	}
 
-		assert(!(ctrl.clock & ~0x3));
+	//Moves the counter to a target, returning the flags raised there
+	int reach_target(uint32_t& value, uint32_t target)
+	{
+		int flags = 0;
+		bool clear_counter = false;
+		value = target & 0xFFFF;
 
-		int64_t time_elapsed = Timing::get_timestamp(Timing::CPU_TIMER) - time_when_started;
-		counter = counter_when_started + (time_elapsed >> ctrl.clock);
-		counter &= 0xFFFF;
+		//Compare 1
+		if (value == gen_reg[0])
+		{
+			flags |= 0x1;
+			clear_counter |= ctrl.clear_mode == 0x1;
+		}
+
+		//Compare 2
+		if (value == gen_reg[1])
+		{
+			flags |= 0x2;
+			clear_counter |= ctrl.clear_mode == 0x2;
+		}
+
+		//Overflow
+		if (value == 0)
+		{
+			flags |= 0x4;
+		}
+
+		if (clear_counter)
+		{
+			value = 0;
+		}
+
+		return flags;
 	}
 
-	void set_enable(bool new_enable)
+	//Advances the counter by a number of ticks, returning the flags raised along the way
+	int advance(uint32_t& value, uint64_t ticks)
 	{
-		enabled = new_enable;
+		int flags = 0;
 
-		if (!ev.is_valid() && enabled)
+		//At most three targets are passed before the counter comes back around to zero
+		while (value != 0 || flags == 0)
 		{
-			start();
+			uint32_t target = next_target(value);
+			if (ticks < target - value)
+			{
+				value += ticks;
+				return flags;
+			}
+
+			ticks -= target - value;
+			flags |= reach_target(value, target);
 		}
-		else if (ev.is_valid() && !enabled)
+
+		//From zero the counter repeats the same period, so skip over whole periods at once
+		uint32_t period_value = 0;
+		uint64_t period = 0;
+		int period_flags = 0;
+		do
 		{
-			Timing::cancel_event(ev);
+			uint32_t target = next_target(period_value);
+			period += target - period_value;
+			period_flags |= reach_target(period_value, target);
+		} while (period_value != 0);
+
+		if (ticks >= period)
+		{
+			flags |= period_flags;
+			ticks %= period;
+		}
+
+		while (ticks)
+		{
+			uint32_t target = next_target(value);
+			if (ticks < target - value)
+			{
+				value += ticks;
+				break;
+			}
+
+			ticks -= target - value;
+			flags |= reach_target(value, target);
 		}
+
+		return flags;
 	}
 
-	void start()
+	void sync()
 	{
+		int64_t now = Timing::get_timestamp(Timing::CPU_TIMER);
+		if (!enabled)
+		{
+			last_sync = now;
+			return;
+		}
+
 		assert(!(ctrl.clock & ~0x3));
 		assert(!ctrl.edge_mode);
 		assert(ctrl.clear_mode != 3);
 
-		//Calculate the target which will take the smallest amount of time to reach
-		constexpr static uint32_t OVERFLOW_TARGET = 0x10000;
-		uint32_t nearest_target = OVERFLOW_TARGET;
-		for (int i = 0; i < 2; i++)
+		uint64_t ticks = (now - last_sync) >> ctrl.clock;
+		last_sync += ticks << ctrl.clock;
+
+		if (ticks)
+		{
+			intr_flag |= advance(counter, ticks);
+		}
+	}
+
+	void schedule()
+	{
+		if (ev.is_valid())
 		{
-			if (counter < gen_reg[i])
+			Timing::cancel_event(ev);
+		}
+
+		int armed = intr_enable & 0x7;
+		if (!enabled || !armed)
+		{
+			return;
+		}
+
+		//Find the next match that raises an enabled interrupt. Two periods are always enough to find one if it exists.
+		uint32_t value = counter;
+		uint64_t ticks = 0;
+		int laps = 0;
+		while (laps < 2)
+		{
+			uint32_t target = next_target(value);
+			ticks += target - value;
+			if (reach_target(value, target) & armed)
 			{
-				nearest_target = std::min(nearest_target, gen_reg[i]);
+				int64_t partial_tick = Timing::get_timestamp(Timing::CPU_TIMER) - last_sync;
+				int64_t cycles = (int64_t)(ticks << ctrl.clock) - partial_tick;
+				Timing::UnitCycle sched_cycles = Timing::convert_cpu(cycles);
+				ev = Timing::add_event(ev_func, sched_cycles, (uint64_t)this, Timing::CPU_TIMER);
+				return;
 			}
-		}
 
-		uint32_t cycles = (nearest_target - counter) << ctrl.clock;
-		Timing::UnitCycle sched_cycles = Timing::convert_cpu(cycles);
-		ev = Timing::add_event(ev_func, sched_cycles, (uint64_t)this, Timing::CPU_TIMER);
+			if (value == 0)
+			{
+				laps++;
+			}
+		}
+	}
 
-		time_when_started = Timing::get_timestamp(Timing::CPU_TIMER);
-		counter_when_started = counter;
+	void set_enable(bool new_enable)
+	{
+		sync();
+		enabled = new_enable;
+		schedule();
 	}
 };
 
@@ -130,60 +251,17 @@ static void update_timer_irq(Timer* timer)
 	}
 }
 
-static void update_timer_target(Timer* timer)
-{
-	// Disable and re-enable to force new timing to take effect
-	if (timer->enabled)
-	{
-		timer->set_enable(false);
-		timer->set_enable(true);
-	}
-}
-
 static void intr_event(uint64_t param, int cycles_late)
 {
 	assert(!cycles_late);
 	Timer* timer = (Timer*)param;
 
-	timer->update_counter();
-
-	bool clear_counter = false;
-
-	//Compare 1
-	if (timer->counter == timer->gen_reg[0])
-	{
-		timer->intr_flag |= 0x1;
-		if (timer->ctrl.clear_mode == 0x1)
-		{
-			clear_counter = true;
-		}
-	}
-
-	//Compare 2
-	if (timer->counter == timer->gen_reg[1])
-	{
-		timer->intr_flag |= 0x2;
-		if (timer->ctrl.clear_mode == 0x2)
-		{
-			clear_counter = true;
-		}
-	}
-
-	//Overflow
-	if (timer->counter == 0)
-	{
-		timer->intr_flag |= 0x4;
-	}
-
-	if (clear_counter)
-	{
-		timer->counter = 0;
-	}
+	//The event is now done, so the handle must not be cancelled when rescheduling
+	timer->ev = Timing::EventHandle();
 
+	timer->sync();
 	update_timer_irq(timer);
-
-	//Restart the timer
-	timer->start();
+	timer->schedule();
 }
 
 static TimerDev get_dev_from_addr(uint32_t addr)
@@ -242,10 +320,17 @@ uint8_t read8(uint32_t addr)
 
 	if (timer)
 	{
+		timer->sync();
 		switch (reg)
 		{
+		case 0x02:
+			return timer->intr_enable | 0x78;
 		case 0x03:
 			return timer->intr_flag | 0x78;
+		case 0x04:
+			return timer->counter >> 8;
+		case 0x05:
+			return timer->counter & 0xFF;
 		default:
 			assert(0);
 			return 0;
@@ -268,6 +353,27 @@ uint8_t read8(uint32_t addr)
 
 uint16_t read16(uint32_t addr)
 {
+	TimerDev dev = get_dev_from_addr(addr);
+
+	Timer* timer = std::get<Timer*>(dev);
+	int reg = std::get<int>(dev);
+
+	if (timer)
+	{
+		switch (reg)
+		{
+		case 0x04:
+			timer->sync();
+			return timer->counter;
+		case 0x06:
+		case 0x08:
+			return timer->gen_reg[(reg - 0x06) >> 1];
+		default:
+			assert(0);
+			return 0;
+		}
+	}
+
 	assert(0);
 	return 0;
 }
@@ -285,11 +391,13 @@ void write8(uint32_t addr, uint8_t value)
 		{
 		case 0x00:
 			Log::debug("[Timer] write timer%d ctrl: %02X", timer->id, value);
-			timer->update_counter();
+			timer->sync();
 			timer->ctrl.clock = value & 0x7;
 			timer->ctrl.edge_mode = (value >> 3) & 0x3;
 			timer->ctrl.clear_mode = (value >> 5) & 0x3;
-			update_timer_target(timer);
+			//Partial ticks of the old prescaler don't carry over
+			timer->last_sync = Timing::get_timestamp(Timing::CPU_TIMER);
+			timer->schedule();
 			break;
 		case 0x01:
 			Log::debug("[Timer] write timer%d io ctrl: %02X", timer->id, value);
@@ -298,28 +406,31 @@ void write8(uint32_t addr, uint8_t value)
 			break;
 		case 0x02:
 			Log::debug("[Timer] write timer%d intr enable: %02X", timer->id, value);
+			timer->sync();
 			timer->intr_enable = value;
 			update_timer_irq(timer);
+			timer->schedule();
 			break;
 		case 0x03:
 			Log::debug("[Timer] write timer%d intr flag: %02X", timer->id, value);
+			timer->sync();
 			timer->intr_flag &= value;
 			update_timer_irq(timer);
 			break;
 		case 0x04:
 			Log::debug("[Timer] write timer%d counter: %02X**", timer->id, value);
 			//The BIOS writes 0 to here under the assumption that it resets the whole counter...
-			timer->update_counter();
+			timer->sync();
 			timer->counter &= 0x00FF;
 			timer->counter |= value << 8;
-			update_timer_target(timer);
+			timer->schedule();
 			break;
 		case 0x05:
 			Log::debug("[Timer] write timer%d counter: **%02X", timer->id, value);
-			timer->update_counter();
+			timer->sync();
 			timer->counter &= 0xFF00;
 			timer->counter |= value;
-			update_timer_target(timer);
+			timer->schedule();
 			break;
 		default:
 			assert(0);
@@ -367,16 +478,17 @@ void write16(uint32_t addr, uint16_t value)
 		{
 		case 0x04:
 			Log::debug("[Timer] write timer%d counter: %04X", timer->id, value);
+			timer->sync();
 			timer->counter = value;
-			update_timer_target(timer);
+			timer->schedule();
 			break;
 		case 0x06:
 		case 0x08:
 			reg = (reg - 0x06) >> 1;
 			Log::debug("[Timer] write timer%d general reg%d: %04X", timer->id, reg, value);
-			timer->update_counter();
+			timer->sync();
 			timer->gen_reg[reg] = value;
-			update_timer_target(timer);
+			timer->schedule();
 			break;
 		default:
 			assert(0);
@@ -32,7 +32,7 @@ void initialize(Config::SystemInfo& config)
 	LoopyIO::initialize();
 
 	//Initialize subprojects after everything else
-	Input::initialize();
+	Input::initialize(config);
 	Video::initialize();
 	Sound::initialize(config.sound_rom);
 	Expansion::initialize(config.cart);
@@ -40,11 +40,22 @@ void initialize(Config::SystemInfo& config)
 
 	//Hook up connections between modules
 	SH2::OCPM::Serial::set_tx_callback(1, &Sound::midi_byte_in);
+
+	Video::set_threaded_render(config.emulator.threaded_render);
+	Video::set_deferred_render(config.emulator.deferred_render_threads);
+	Video::set_write_log(config.emulator.write_log_size);
+
+	//Timing domains start last, once every timer and event function is registered
+	if (config.emulator.threaded_timing)
+	{
+		Timing::start_domains(config.emulator.timing_max_skew);
+	}
 }
 
 void shutdown(Config::SystemInfo& config)
 {
 	//Shutdown all components in the reverse order they were initialized
+	Timing::stop_domains();
 	Printer::shutdown();
 	Expansion::shutdown();
 	Sound::shutdown();
@@ -67,20 +78,8 @@ void run()
 
 	while (!Video::check_frame_end())
 	{
-		//TODO: if multiple cores are added, ensure that they are relatively synced
-
-		//Calculate the smallest timeslice between all cores
-		int64_t slice_length = (std::numeric_limits<int64_t>::max)();
-		for (int i = 0; i < Timing::NUM_TIMERS; i++)
-		{
-			slice_length = std::min(slice_length, Timing::calc_slice_length(i));
-		}
-
 		//Run all cores, processing any scheduler events that happen for them
-		for (int i = 0; i < Timing::NUM_TIMERS; i++)
-		{
-			Timing::process_slice(i, slice_length);
-		}
+		Timing::run_slice();
 	}
 
 	Cart::sram_commit_check();
@@ -1,7 +1,15 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
+#include <log/log.h>
 #include "core/timing.h"
+#include "core/timing_local.h"
 
 namespace Timing
 {
@@ -12,14 +20,12 @@ struct RegisteredFunc
 	EventFunc func;
 };
 
-struct Event
+/* Events sent to a timer from another host thread, moved into its queue by the thread that owns it. */
+struct Mailbox
 {
-	int64_t exec_time;
-	uint64_t param;
-	EventFunc func;
-	int64_t id;
-
-	friend bool operator>(const Event& l, const Event& r);
+	std::mutex mutex;
+	std::vector<Event> events;
+	std::atomic<bool> pending{false};
 };
 
 struct Timer
@@ -28,11 +34,20 @@ struct Timer
 	int64_t next_event_id;
 	int32_t slice_length;
 	int32_t* cycles_left;
-	std::vector<Event> events;
+	EventQueue events;
 	TimerFunc func;
 	int id;
 	bool in_slice;
 
+	bool threaded;
+	std::unique_ptr<Mailbox> mailbox;
+	std::thread thread;
+
+	//Where a threaded timer was when it last finished a slice, guarded by domain_mutex while domains run
+	int64_t published_timestamp;
+	int64_t published_next_event;
+	int64_t synced_slices;
+
 	int64_t get_timestamp()
 	{
 		int64_t result = timestamp;
@@ -56,32 +71,105 @@ struct Timer
 
 struct State
 {
-	Timer* cur_timer;
 	std::vector<RegisteredFunc> funcs;
 	std::vector<Timer> timers;
 };
 
 static State state;
 
-bool operator>(const Event& l, const Event& r)
-{
-	return l.exec_time > r.exec_time;
-}
+//The timer running a slice on this host thread, and the threaded timer this thread runs (null on the emulation thread)
+static thread_local Timer* cur_timer;
+static thread_local Timer* domain_timer;
+
+//Barrier between the emulation thread and the domain threads
+static std::mutex domain_mutex;
+static std::condition_variable domain_cv;
+static int64_t domain_max_skew;
+static int64_t domain_cpu_timestamp;
+static int64_t domain_slices;
+static bool domains_running;
+static bool domains_quit;
+
+//Kept apart from the state, so a trace covers everything up to shutdown
+static std::ofstream trace_file;
+static std::mutex trace_mutex;
 
 static Timer* get_timer(int id)
 {
 	if (id < 0)
 	{
-		return state.cur_timer;
+		return cur_timer;
 	}
 
 	assert(id < state.timers.size());
 	return &state.timers[id];
 }
 
+static void trace(TraceOp op, int timer_id, int64_t exec_time = 0, int64_t id = 0, int64_t key = 0)
+{
+	if (trace_file.is_open())
+	{
+		TraceEntry entry = {};
+		entry.op = op;
+		entry.timer = timer_id;
+		entry.exec_time = exec_time;
+		entry.id = id;
+		entry.key = key;
+
+		//Domain threads trace their own timers, so entries are only in order for each timer
+		std::lock_guard<std::mutex> lock(trace_mutex);
+		trace_file.write((char*)&entry, sizeof(entry));
+	}
+}
+
+//While domains run, each threaded timer belongs to its own thread, and every other timer to the emulation thread
+static bool is_other_thread(Timer* timer)
+{
+	if (!domains_running)
+	{
+		return false;
+	}
+
+	Timer* owner = timer->threaded ? timer : nullptr;
+	return owner != domain_timer;
+}
+
+static int64_t push_event(Timer* timer, Event ev)
+{
+	ev.id = timer->next_event_id;
+	timer->next_event_id++;
+
+	int64_t exec_time = ev.exec_time;
+	int64_t id = ev.id;
+	int64_t key = timer->events.push(std::move(ev));
+	trace(TRACE_PUSH, timer->id, exec_time, id, key);
+	return key;
+}
+
+static void drain_mailbox(Timer* timer)
+{
+	if (!domains_running || !timer->mailbox->pending.load(std::memory_order_acquire))
+	{
+		return;
+	}
+
+	std::vector<Event> received;
+	{
+		std::lock_guard<std::mutex> lock(timer->mailbox->mutex);
+		received.swap(timer->mailbox->events);
+		timer->mailbox->pending.store(false, std::memory_order_relaxed);
+	}
+
+	//Events keep the order they were sent in, and get their IDs from the receiving timer like any other event
+	for (Event& ev : received)
+	{
+		push_event(timer, std::move(ev));
+	}
+}
+
 static void process_events()
 {
-	Timer* timer = state.cur_timer;
+	Timer* timer = cur_timer;
 
 	int32_t cycles_executed = timer->slice_length - timer->get_cycles_left();
 	timer->timestamp += cycles_executed;
@@ -90,11 +178,10 @@ static void process_events()
 
 	timer->in_slice = false;
 
-	while (!timer->events.empty() && timer->events.front().exec_time <= timer->get_timestamp())
+	while (!timer->events.empty() && timer->events.top().exec_time <= timer->get_timestamp())
 	{
-		Event ev = std::move(timer->events.front());
-		std::pop_heap(timer->events.begin(), timer->events.end(), std::greater<>());
-		timer->events.pop_back();
+		Event ev = timer->events.pop();
+		trace(TRACE_POP, timer->id, ev.exec_time, ev.id);
 
 		int cycles_late = timer->timestamp - ev.exec_time;
 		ev.func(ev.param, cycles_late);
@@ -110,31 +197,231 @@ static void set_cur_timer(int id, int32_t slice)
 	timer->set_cycles_left(slice);
 	timer->in_slice = true;
 
-	state.cur_timer = timer;
+	cur_timer = timer;
+}
+
+//Runs once the other cores are to catch up to CPU_TIMER, and waits until the threaded ones are close enough to it
+static void sync_domains(int64_t cpu_timestamp)
+{
+	if (!domains_running)
+	{
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(domain_mutex);
+	domain_cpu_timestamp = cpu_timestamp;
+	domain_slices++;
+	domain_cv.notify_all();
+
+	//In lockstep every domain runs the slice before the CPU goes on, otherwise it can fall max_skew cycles behind
+	domain_cv.wait(lock, [] {
+		for (Timer& timer : state.timers)
+		{
+			bool behind = domain_max_skew ? timer.published_timestamp < domain_cpu_timestamp - domain_max_skew
+										  : timer.synced_slices < domain_slices;
+			if (timer.threaded && behind)
+			{
+				return false;
+			}
+		}
+		return true;
+	});
+}
+
+//The slice a timer on another thread would stop the emulation thread's slice at, if it ran there
+static int64_t calc_lockstep_slice_length(Timer* timer)
+{
+	int64_t next_event;
+	int64_t timestamp;
+	{
+		std::lock_guard<std::mutex> lock(domain_mutex);
+		next_event = timer->published_next_event;
+		timestamp = timer->published_timestamp;
+	}
+
+	//Events still in the mailbox would already be in the queue
+	{
+		std::lock_guard<std::mutex> lock(timer->mailbox->mutex);
+		for (Event& ev : timer->mailbox->events)
+		{
+			next_event = std::min(next_event, ev.exec_time);
+		}
+	}
+
+	return std::min(MAX_SLICE_LENGTH, next_event - timestamp);
+}
+
+static void domain_thread(Timer* timer)
+{
+	domain_timer = timer;
+
+	std::unique_lock<std::mutex> lock(domain_mutex);
+	while (!domains_quit)
+	{
+		//In lockstep the timer runs once for every slice of the CPU, even an empty one, like it would on the
+		//emulation thread. Otherwise it runs on until it's max_skew cycles ahead of the CPU.
+		int64_t limit = domain_cpu_timestamp + domain_max_skew;
+		bool can_run = domain_max_skew ? timer->timestamp < limit : timer->synced_slices < domain_slices;
+		if (!can_run)
+		{
+			domain_cv.wait(lock);
+			continue;
+		}
+		int64_t slices = domain_slices;
+		lock.unlock();
+
+		//In lockstep the slice is the one catching up with the CPU. Otherwise the timer stops at its own events too,
+		//so they don't run up to max_skew cycles late.
+		int64_t slice_length = limit - timer->timestamp;
+		if (domain_max_skew)
+		{
+			slice_length = std::min(slice_length, calc_slice_length(timer->id));
+		}
+		process_slice(timer->id, (int32_t)slice_length);
+
+		lock.lock();
+		timer->published_timestamp = timer->timestamp;
+		timer->published_next_event = timer->events.empty() ? MAX_TIMESTAMP : timer->events.top().exec_time;
+		timer->synced_slices = slices;
+		domain_cv.notify_all();
+	}
+
+	cur_timer = nullptr;
+	domain_timer = nullptr;
 }
 
 void initialize()
 {
+	stop_domains();
+
 	state = {};
+	cur_timer = nullptr;
 
 	state.timers = std::vector<Timer>(NUM_TIMERS);
+	for (int i = 0; i < NUM_TIMERS; i++)
+	{
+		state.timers[i].id = i;
+		state.timers[i].mailbox = std::make_unique<Mailbox>();
+	}
 }
 
 void shutdown()
 {
+	stop_domains();
+	stop_trace();
 	state = {};
+	cur_timer = nullptr;
 }
 
-void register_timer(TimerId id, int32_t* cycle_count, TimerFunc func)
+void register_timer(TimerId id, int32_t* cycle_count, TimerFunc func, bool threaded)
 {
 	//Ensure new timers are registered only during initialization
-	assert(!state.cur_timer);
+	assert(!cur_timer);
+	assert(!domains_running);
 	assert(cycle_count);
 	assert(id < NUM_TIMERS);
 
 	state.timers[id].cycles_left = cycle_count;
 	state.timers[id].id = id;
 	state.timers[id].func = func;
+	state.timers[id].threaded = threaded;
+}
+
+void run_slice()
+{
+	//Calculate the smallest timeslice between all cores
+	int64_t slice_length = MAX_SLICE_LENGTH;
+	for (int i = 0; i < NUM_TIMERS; i++)
+	{
+		slice_length = std::min(slice_length, calc_slice_length(i));
+	}
+
+	//The CPU can run past the end of its slice, so the other cores run until they've caught up with it instead of
+	//for the same length. Otherwise they would fall further behind the CPU with every slice.
+	process_slice(CPU_TIMER, slice_length);
+
+	int64_t cpu_timestamp = state.timers[CPU_TIMER].timestamp;
+	for (Timer& timer : state.timers)
+	{
+		if (timer.id != CPU_TIMER && timer.func && !is_threaded(timer.id))
+		{
+			process_slice(timer.id, cpu_timestamp - timer.timestamp);
+		}
+	}
+
+	sync_domains(cpu_timestamp);
+}
+
+void start_domains(int64_t max_skew)
+{
+	assert(!domains_running);
+	assert(max_skew >= 0);
+
+	int count = 0;
+	for (Timer& timer : state.timers)
+	{
+		count += timer.threaded && timer.func;
+	}
+
+	if (!count)
+	{
+		return;
+	}
+
+	domain_max_skew = max_skew;
+	domain_cpu_timestamp = state.timers[CPU_TIMER].timestamp;
+	domain_slices = 0;
+	domains_quit = false;
+	domains_running = true;
+
+	for (Timer& timer : state.timers)
+	{
+		if (timer.threaded && timer.func)
+		{
+			assert(timer.id != CPU_TIMER);
+			timer.published_timestamp = timer.timestamp;
+			timer.published_next_event = timer.events.empty() ? MAX_TIMESTAMP : timer.events.top().exec_time;
+			timer.synced_slices = 0;
+			timer.thread = std::thread(domain_thread, &timer);
+		}
+	}
+
+	Log::info("[Timing] running %d timing domain(s) on their own threads, max skew %lld cycles", count,
+			  (long long)max_skew);
+}
+
+void stop_domains()
+{
+	if (!domains_running)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(domain_mutex);
+		domains_quit = true;
+	}
+	domain_cv.notify_all();
+
+	for (Timer& timer : state.timers)
+	{
+		if (timer.thread.joinable())
+		{
+			timer.thread.join();
+		}
+	}
+
+	//Nothing sent to a domain is lost, it's just left for the emulation thread to run
+	for (Timer& timer : state.timers)
+	{
+		drain_mailbox(&timer);
+	}
+	domains_running = false;
+}
+
+bool is_threaded(int id)
+{
+	return domains_running && get_timer(id)->threaded;
 }
 
 FuncHandle register_func(std::string name, EventFunc func)
@@ -158,25 +445,32 @@ EventHandle add_event(FuncHandle func, UnitCycle cycles, uint64_t param, int cor
 	Event ev;
 	ev.func = reg_func->func;
 	ev.param = param;
-	ev.id = (timer->next_event_id << 8) | timer->id;
-	timer->next_event_id++;
 
+	//Events for another timer are timed from the clock of the one adding them, as the two aren't exactly in step
+	Timer* sender = cur_timer ? cur_timer : timer;
 	int64_t raw_cycles = (int64_t)cycles;
-	ev.exec_time = timer->get_timestamp() + raw_cycles;
+	ev.exec_time = sender->get_timestamp() + raw_cycles;
+
+	if (is_other_thread(timer))
+	{
+		std::lock_guard<std::mutex> lock(timer->mailbox->mutex);
+		timer->mailbox->events.push_back(std::move(ev));
+		timer->mailbox->pending.store(true, std::memory_order_release);
+		return EventHandle();
+	}
 
 	int32_t raw_cycles_left = timer->get_cycles_left();
-	if (timer->in_slice && raw_cycles < raw_cycles_left && timer == state.cur_timer)
+	if (timer->in_slice && raw_cycles < raw_cycles_left && timer == cur_timer)
 	{
 		//If the event is scheduled during a slice and should occur before the slice ends, adjust the slice length
 		timer->slice_length -= raw_cycles_left - raw_cycles;
 		timer->set_cycles_left(raw_cycles);
 	}
 
-	timer->events.push_back(ev);
-	std::push_heap(timer->events.begin(), timer->events.end(), std::greater<>());
+	int64_t key = push_event(timer, std::move(ev));
 
 	EventHandle handle;
-	handle.value = ev.id;
+	handle.value = (key << 8) | timer->id;
 	return handle;
 }
 
@@ -185,20 +479,11 @@ void cancel_event(EventHandle& ev)
 	assert(ev.is_valid());
 
 	Timer* timer = get_timer(ev.get_timer_id());
+	assert(!is_other_thread(timer));
 
-	bool event_found = false;
-	for (auto it = timer->events.begin(); it != timer->events.end(); it++)
-	{
-		if (it->id == ev.value)
-		{
-			event_found = true;
-			timer->events.erase(it);
-			std::make_heap(timer->events.begin(), timer->events.end(), std::greater<>());
-			break;
-		}
-	}
-
+	bool event_found = timer->events.cancel(ev.get_ev_id());
 	assert(event_found);
+	trace(TRACE_CANCEL, timer->id, 0, 0, ev.get_ev_id());
 
 	//Indicate that the handle is now invalid
 	ev.value = -1;
@@ -206,21 +491,30 @@ void cancel_event(EventHandle& ev)
 
 void process_slice(int id, int32_t slice)
 {
+	drain_mailbox(get_timer(id));
 	set_cur_timer(id, slice);
-	state.cur_timer->func();
+	cur_timer->func();
 	process_events();
 }
 
 int64_t calc_slice_length(int id)
 {
 	Timer* timer = get_timer(id);
+	if (is_other_thread(timer))
+	{
+		//A timer on another thread only holds this one back when they run in lockstep
+		return domain_max_skew ? MAX_SLICE_LENGTH : calc_lockstep_slice_length(timer);
+	}
 
-	if (!timer->events.size())
+	drain_mailbox(timer);
+
+	if (timer->events.empty())
 	{
 		return MAX_SLICE_LENGTH;
 	}
 
-	int64_t next_event_delta = timer->events.front().exec_time - timer->get_timestamp();
+	trace(TRACE_PEEK, timer->id);
+	int64_t next_event_delta = timer->events.top().exec_time - timer->get_timestamp();
 	int64_t slice_length = std::min(MAX_SLICE_LENGTH, next_event_delta);
 
 	return slice_length;
@@ -230,9 +524,61 @@ int64_t get_timestamp(int id)
 {
 	Timer* timer = get_timer(id);
 
+	if (is_other_thread(timer))
+	{
+		//Timers on other threads are seen where they last synced
+		std::lock_guard<std::mutex> lock(domain_mutex);
+		return timer->threaded ? timer->published_timestamp : domain_cpu_timestamp;
+	}
+
 	return timer->get_timestamp();
 }
 
+bool start_trace(fs::path path)
+{
+	if (trace_file.is_open())
+	{
+		return false;
+	}
+
+	trace_file.open(path, std::ios::binary);
+	if (!trace_file.is_open())
+	{
+		Log::error("[Timing] could not open %s for writing", path.string().c_str());
+		return false;
+	}
+
+	trace_file.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+
+	//The replay needs every event that can still run or be cancelled
+	std::vector<PendingEvent> pending;
+	for (Timer& timer : state.timers)
+	{
+		pending.clear();
+		timer.events.get_pending(pending);
+		for (PendingEvent& ev : pending)
+		{
+			trace(TRACE_PUSH, timer.id, ev.exec_time, ev.id, ev.key);
+		}
+	}
+	Log::info("[Timing] tracing events to %s", path.string().c_str());
+	return true;
+}
+
+void stop_trace()
+{
+	if (trace_file.is_open())
+	{
+		trace_file.close();
+		Log::info("[Timing] stopped tracing events");
+	}
+}
+
+bool is_tracing()
+{
+	return trace_file.is_open();
+}
+
 UnitCycle convert_cpu(int64_t cycles)
 {
 	return convert<F_CPU>(cycles);
@@ -1,15 +1,19 @@
 #pragma once
+#include <filesystem>
 #include <functional>
 #include <string>
 #include <limits>
 #include <cstdint>
 
+namespace fs = std::filesystem;
+
 namespace Timing
 {
 
 enum TimerId
 {
 	CPU_TIMER,
+	SOUND_TIMER,
 	NUM_TIMERS,
 	INVALID_TIMER
 };
@@ -53,7 +57,21 @@ enum class UnitCycle : int64_t;
 void initialize();
 void shutdown();
 
-void register_timer(TimerId id, int32_t* cycle_count, TimerFunc func);
+void register_timer(TimerId id, int32_t* cycle_count, TimerFunc func, bool threaded = false);
+
+//Runs every core for one slice, which lasts until the next event of any of them. The CPU runs first, and the other
+//cores then catch up to wherever it ended up.
+void run_slice();
+
+/*
+ * Timing domains: once started, each timer registered as threaded runs on its own host thread and stays within
+ * max_skew cycles of CPU_TIMER. Events added for a timer on another thread go through its mailbox, are timed from the
+ * sender's clock, and can't be cancelled. With a skew of zero the domains run in lockstep with the CPU, and events
+ * happen in the same order and on the same cycles as when every timer runs on the emulation thread.
+ */
+void start_domains(int64_t max_skew);
+void stop_domains();
+bool is_threaded(int id);
 
 FuncHandle register_func(std::string name, EventFunc func);
 
@@ -65,6 +83,11 @@ int64_t calc_slice_length(int id);
 
 int64_t get_timestamp(int id = -1);
 
+//Records every event queue operation until stopped or shut down, for the timingbench tool to replay
+bool start_trace(fs::path path);
+void stop_trace();
+bool is_tracing();
+
 UnitCycle convert_cpu(int64_t cycles);
 
 template <int FREQ> UnitCycle convert(int64_t num)
@@ -0,0 +1,142 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "core/timing.h"
+
+namespace Timing
+{
+
+struct Event
+{
+	int64_t exec_time;
+	uint64_t param;
+	EventFunc func;
+	int64_t id;
+
+	friend bool operator>(const Event& l, const Event& r);
+};
+
+/*
+ * Both event queues take events with an id that orders events scheduled for the same cycle, and return a key from
+ * push() that is later passed to cancel(). Keys are always below 2^55, so they fit in an EventHandle with the timer ID.
+ */
+
+struct PendingEvent
+{
+	int64_t exec_time;
+	int64_t id;
+	int64_t key;
+};
+
+/* Binary min-heap of events. Cancelling is linear in the number of pending events. */
+class EventHeap
+{
+public:
+	bool empty();
+	const Event& top();
+	Event pop();
+	int64_t push(Event ev);
+	bool cancel(int64_t key);
+	void get_pending(std::vector<PendingEvent>& pending);
+
+private:
+	std::vector<Event> events;
+};
+
+/*
+ * Hierarchical timing wheel. Level 0 has one slot per 64 cycles and covers the current 16384-cycle block, level 1 has
+ * one slot per block and covers the next 255 blocks (about a quarter of a second), and anything further away waits
+ * in an overflow heap. Inserting and cancelling near events is O(1); slots are cascaded down as time advances.
+ */
+class EventWheel
+{
+public:
+	bool empty();
+	const Event& top();
+	Event pop();
+	int64_t push(Event ev);
+	bool cancel(int64_t key);
+	void get_pending(std::vector<PendingEvent>& pending);
+
+private:
+	constexpr static int SLOT_BITS = 8;
+	constexpr static int SLOT_COUNT = 1 << SLOT_BITS;
+	constexpr static int LEVEL0_SHIFT = 6;
+	constexpr static int LEVEL1_SHIFT = LEVEL0_SHIFT + SLOT_BITS;
+	constexpr static int OVERFLOW_SLOT = -1;
+	constexpr static int FREE_SLOT = -2;
+
+	//A key is a node index with the node's generation above it, so stale keys don't match a reused node
+	constexpr static int NODE_BITS = 24;
+	constexpr static uint32_t GENERATION_MASK = 0x7FFFFFFF;
+
+	//Pending events live in a pool of nodes that's reused, so the wheel stops allocating once the pool has grown
+	struct Node
+	{
+		Event ev;
+		int slot; //level * SLOT_COUNT + index, OVERFLOW_SLOT or FREE_SLOT
+		int pos;  //Index in the slot's list, so removing from a slot doesn't need to search it
+		uint32_t generation;
+	};
+
+	struct Level
+	{
+		std::vector<int> slots[SLOT_COUNT];
+		uint64_t occupied[SLOT_COUNT / 64];
+		int count;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<int> free_nodes;
+
+	Level levels[2] = {};
+	std::vector<int> overflow;
+	std::vector<int> cascade;
+	int count = 0;
+
+	//Start of the level 0 slot that time has advanced to
+	int64_t cursor = 0;
+
+	int top_slot = -1;
+	int top_index = -1;
+
+	bool is_later(int l, int r);
+	void free_node(int node);
+	void insert(int node);
+	void add_to_slot(int level, int index, int node);
+	void remove_from_slot(int level, int index, int pos);
+	void advance_block();
+	void find_top();
+};
+
+/*
+ * Event traces record every queue operation made by the scheduler, so the two queues can be compared on the events a
+ * real game schedules. A trace is TRACE_MAGIC followed by TraceEntry records in host byte order. Events already
+ * pending when the trace starts are recorded as pushes at the beginning.
+ */
+constexpr static char TRACE_MAGIC[8] = {'L', 'P', 'T', 'R', 'A', 'C', 'E', '1'};
+
+enum TraceOp : uint8_t
+{
+	TRACE_PUSH,
+	TRACE_POP,
+	TRACE_CANCEL,
+	TRACE_PEEK
+};
+
+struct TraceEntry
+{
+	uint8_t op;
+	uint8_t timer;
+	int64_t exec_time; //PUSH and POP
+	int64_t id;		   //PUSH and POP
+	int64_t key;	   //PUSH and CANCEL: the key the queue returned for the event
+};
+
+#ifdef LOOPY_TIMING_WHEEL
+typedef EventWheel EventQueue;
+#else
+typedef EventHeap EventQueue;
+#endif
+
+}  // namespace Timing
@@ -0,0 +1,325 @@
+#include <algorithm>
+#include <cassert>
+#include "core/timing_local.h"
+
+namespace Timing
+{
+
+bool operator>(const Event& l, const Event& r)
+{
+	//Events scheduled for the same cycle run in the order they were added
+	if (l.exec_time != r.exec_time)
+	{
+		return l.exec_time > r.exec_time;
+	}
+	return l.id > r.id;
+}
+
+bool EventHeap::empty()
+{
+	return events.empty();
+}
+
+const Event& EventHeap::top()
+{
+	return events.front();
+}
+
+Event EventHeap::pop()
+{
+	std::pop_heap(events.begin(), events.end(), std::greater<>());
+	Event ev = std::move(events.back());
+	events.pop_back();
+	return ev;
+}
+
+int64_t EventHeap::push(Event ev)
+{
+	int64_t key = ev.id;
+	events.push_back(std::move(ev));
+	std::push_heap(events.begin(), events.end(), std::greater<>());
+	return key;
+}
+
+bool EventHeap::cancel(int64_t key)
+{
+	for (auto it = events.begin(); it != events.end(); it++)
+	{
+		if (it->id == key)
+		{
+			events.erase(it);
+			std::make_heap(events.begin(), events.end(), std::greater<>());
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void EventHeap::get_pending(std::vector<PendingEvent>& pending)
+{
+	for (Event& ev : events)
+	{
+		pending.push_back({ev.exec_time, ev.id, ev.id});
+	}
+}
+
+bool EventWheel::empty()
+{
+	return !count;
+}
+
+const Event& EventWheel::top()
+{
+	assert(!empty());
+	if (top_slot < 0)
+	{
+		find_top();
+	}
+	return nodes[levels[0].slots[top_slot][top_index]].ev;
+}
+
+Event EventWheel::pop()
+{
+	top();
+
+	int node = levels[0].slots[top_slot][top_index];
+	Event ev = std::move(nodes[node].ev);
+	remove_from_slot(0, top_slot, top_index);
+	free_node(node);
+
+	//Time can't go backwards past the event that just ran
+	int64_t slot_start = (ev.exec_time >> LEVEL0_SHIFT) << LEVEL0_SHIFT;
+	cursor = std::max(cursor, slot_start);
+
+	top_slot = -1;
+	return ev;
+}
+
+int64_t EventWheel::push(Event ev)
+{
+	int node;
+	if (!free_nodes.empty())
+	{
+		node = free_nodes.back();
+		free_nodes.pop_back();
+	}
+	else
+	{
+		assert(nodes.size() < ((size_t)1 << NODE_BITS));
+		node = nodes.size();
+		nodes.push_back({});
+	}
+
+	nodes[node].ev = std::move(ev);
+	count++;
+	top_slot = -1;
+	insert(node);
+
+	return ((int64_t)nodes[node].generation << NODE_BITS) | node;
+}
+
+bool EventWheel::cancel(int64_t key)
+{
+	int node = key & ((1 << NODE_BITS) - 1);
+	if (node >= (int)nodes.size() || nodes[node].generation != (key >> NODE_BITS) || nodes[node].slot == FREE_SLOT)
+	{
+		return false;
+	}
+
+	int slot = nodes[node].slot;
+	top_slot = -1;
+
+	if (slot == OVERFLOW_SLOT)
+	{
+		//Far events are rare, so they're searched for instead of tracking their place in the heap
+		auto it = std::find(overflow.begin(), overflow.end(), node);
+		assert(it != overflow.end());
+		overflow.erase(it);
+		std::make_heap(overflow.begin(), overflow.end(), [this](int l, int r) { return is_later(l, r); });
+	}
+	else
+	{
+		remove_from_slot(slot / SLOT_COUNT, slot % SLOT_COUNT, nodes[node].pos);
+	}
+
+	free_node(node);
+	return true;
+}
+
+void EventWheel::get_pending(std::vector<PendingEvent>& pending)
+{
+	for (int i = 0; i < (int)nodes.size(); i++)
+	{
+		if (nodes[i].slot != FREE_SLOT)
+		{
+			pending.push_back({nodes[i].ev.exec_time, nodes[i].ev.id, ((int64_t)nodes[i].generation << NODE_BITS) | i});
+		}
+	}
+}
+
+bool EventWheel::is_later(int l, int r)
+{
+	return nodes[l].ev > nodes[r].ev;
+}
+
+void EventWheel::free_node(int node)
+{
+	//Dropping the function now releases anything it captured, instead of whenever the node is reused
+	nodes[node].ev.func = nullptr;
+	nodes[node].slot = FREE_SLOT;
+	nodes[node].generation = (nodes[node].generation + 1) & GENERATION_MASK;
+	free_nodes.push_back(node);
+	count--;
+}
+
+void EventWheel::insert(int node)
+{
+	//Events in the past are placed in the current slot, where they still sort before everything else
+	int64_t time = std::max(nodes[node].ev.exec_time, cursor);
+	int64_t block = time >> LEVEL1_SHIFT;
+	int64_t cur_block = cursor >> LEVEL1_SHIFT;
+
+	if (block == cur_block)
+	{
+		add_to_slot(0, (time >> LEVEL0_SHIFT) & (SLOT_COUNT - 1), node);
+	}
+	else if (block - cur_block < SLOT_COUNT)
+	{
+		add_to_slot(1, block & (SLOT_COUNT - 1), node);
+	}
+	else
+	{
+		nodes[node].slot = OVERFLOW_SLOT;
+		overflow.push_back(node);
+		std::push_heap(overflow.begin(), overflow.end(), [this](int l, int r) { return is_later(l, r); });
+	}
+}
+
+void EventWheel::add_to_slot(int level, int index, int node)
+{
+	Level& lvl = levels[level];
+	nodes[node].slot = level * SLOT_COUNT + index;
+	nodes[node].pos = lvl.slots[index].size();
+	lvl.slots[index].push_back(node);
+	lvl.occupied[index / 64] |= 1ULL << (index % 64);
+	lvl.count++;
+}
+
+void EventWheel::remove_from_slot(int level, int index, int pos)
+{
+	Level& lvl = levels[level];
+	std::vector<int>& slot = lvl.slots[index];
+
+	//Order within a slot doesn't matter, so swap with the last event instead of shifting
+	if (pos != (int)slot.size() - 1)
+	{
+		slot[pos] = slot.back();
+		nodes[slot[pos]].pos = pos;
+	}
+	slot.pop_back();
+
+	if (slot.empty())
+	{
+		lvl.occupied[index / 64] &= ~(1ULL << (index % 64));
+	}
+	lvl.count--;
+}
+
+void EventWheel::advance_block()
+{
+	//Only called once nothing is left in the current block, so jump straight to the next occupied one
+	int64_t cur_block = cursor >> LEVEL1_SHIFT;
+	int64_t next_block = INT64_MAX;
+
+	if (levels[1].count)
+	{
+		for (int64_t i = 1; i < SLOT_COUNT; i++)
+		{
+			int index = (cur_block + i) & (SLOT_COUNT - 1);
+			if (levels[1].occupied[index / 64] & (1ULL << (index % 64)))
+			{
+				next_block = cur_block + i;
+				break;
+			}
+		}
+	}
+
+	if (!overflow.empty())
+	{
+		next_block = std::min(next_block, nodes[overflow.front()].ev.exec_time >> LEVEL1_SHIFT);
+	}
+
+	assert(next_block != INT64_MAX);
+	cursor = next_block << LEVEL1_SHIFT;
+
+	//Cascade the new block down to level 0. The lists are swapped rather than copied, so both keep their capacity.
+	int index = next_block & (SLOT_COUNT - 1);
+	cascade.swap(levels[1].slots[index]);
+	levels[1].occupied[index / 64] &= ~(1ULL << (index % 64));
+	levels[1].count -= cascade.size();
+
+	for (int node : cascade)
+	{
+		insert(node);
+	}
+	cascade.clear();
+
+	//Pull in far events that are now within range of level 1
+	auto later = [this](int l, int r) { return is_later(l, r); };
+	while (!overflow.empty() && (nodes[overflow.front()].ev.exec_time >> LEVEL1_SHIFT) - next_block < SLOT_COUNT)
+	{
+		std::pop_heap(overflow.begin(), overflow.end(), later);
+		int node = overflow.back();
+		overflow.pop_back();
+		insert(node);
+	}
+}
+
+void EventWheel::find_top()
+{
+	while (!levels[0].count)
+	{
+		advance_block();
+	}
+
+	//Scan the occupied bitmap from the cursor's slot to the end of the block
+	int start = (cursor >> LEVEL0_SHIFT) & (SLOT_COUNT - 1);
+	int index = -1;
+	for (int word = start / 64; word < SLOT_COUNT / 64; word++)
+	{
+		uint64_t bits = levels[0].occupied[word];
+		if (word == start / 64)
+		{
+			bits &= ~0ULL << (start % 64);
+		}
+
+		if (bits)
+		{
+			index = word * 64;
+			while (!(bits & 1))
+			{
+				bits >>= 1;
+				index++;
+			}
+			break;
+		}
+	}
+
+	assert(index >= 0);
+
+	std::vector<int>& slot = levels[0].slots[index];
+	int best = 0;
+	for (int i = 1; i < (int)slot.size(); i++)
+	{
+		if (is_later(slot[best], slot[i]))
+		{
+			best = i;
+		}
+	}
+
+	top_slot = index;
+	top_index = best;
+}
+
+}  // namespace Timing
@@ -1,24 +1,184 @@
 #include "input/input.h"
 
 #include <core/loopy_io.h>
+#include <core/timing.h>
+#include <log/log.h>
 
+#include <algorithm>
+#include <cassert>
+#include <fstream>
 #include <unordered_map>
 
 namespace Input
 {
 
+/*
+ * Host input isn't applied to LoopyIO directly. Each change is resolved to a Loopy pad/mouse action, stamped with the
+ * CPU timestamp, and applied through a scheduler event. Input therefore becomes visible to the game at a defined
+ * cycle, and a recording of the actions replays identically.
+ */
+enum ActionType
+{
+	ACTION_PAD,
+	ACTION_MOUSE_BUTTONS,
+	ACTION_MOUSE_MOVE
+};
+
+struct Action
+{
+	int64_t timestamp;
+	int type;
+	int a;
+	int b;
+};
+
 static std::unordered_map<int, PadButton> key_bindings;
 static std::unordered_map<int, PadButton> controller_bindings;
 
-void initialize()
+static Timing::FuncHandle action_func;
+
+static std::ofstream record_file;
+static std::ifstream playback_file;
+static bool playing_back;
+static Action next_playback;
+
+static uint64_t pack_action(const Action& action)
+{
+	//Mouse deltas are signed, so every field is stored as 16 bits and sign extended when unpacked
+	uint64_t param = action.type & 0xFF;
+	param |= (uint64_t)(uint16_t)action.a << 8;
+	param |= (uint64_t)(uint16_t)action.b << 24;
+	return param;
+}
+
+static void apply_action(int type, int a, int b)
+{
+	switch (type)
+	{
+	case ACTION_PAD:
+		LoopyIO::update_pad(a, b != 0);
+		break;
+	case ACTION_MOUSE_BUTTONS:
+		LoopyIO::update_mouse_buttons(a, b != 0);
+		break;
+	case ACTION_MOUSE_MOVE:
+		LoopyIO::update_mouse_position(a, b);
+		break;
+	default:
+		assert(0);
+	}
+}
+
+static void read_next_playback()
+{
+	Action& action = next_playback;
+	if (!(playback_file >> action.timestamp >> action.type >> action.a >> action.b))
+	{
+		Log::info("[Input] input playback finished");
+		playback_file.close();
+		playing_back = false;
+		return;
+	}
+
+	int64_t delay = std::max<int64_t>(action.timestamp - Timing::get_timestamp(Timing::CPU_TIMER), 0);
+	Timing::add_event(action_func, (Timing::UnitCycle)delay, pack_action(action), Timing::CPU_TIMER);
+}
+
+static void action_event(uint64_t param, int cycles_late)
+{
+	int type = param & 0xFF;
+	int a = (int16_t)(param >> 8);
+	int b = (int16_t)(param >> 24);
+
+	//Pad and mouse button masks are unsigned
+	if (type != ACTION_MOUSE_MOVE)
+	{
+		a &= 0xFFFF;
+	}
+
+	//Actions are recorded as they're applied, so re-recording a playback works too
+	if (record_file.is_open())
+	{
+		int64_t timestamp = Timing::get_timestamp(Timing::CPU_TIMER) - cycles_late;
+		record_file << timestamp << " " << type << " " << a << " " << b << "\n";
+	}
+
+	apply_action(type, a, b);
+
+	if (playing_back)
+	{
+		read_next_playback();
+	}
+}
+
+static void queue_action(int type, int a, int b)
+{
+	//Live input is ignored while a recording is played back
+	if (playing_back)
+	{
+		return;
+	}
+
+	//Without a running system, there's no clock to apply the action at
+	if (!action_func.is_valid())
+	{
+		apply_action(type, a, b);
+		return;
+	}
+
+	Action action;
+	action.timestamp = Timing::get_timestamp(Timing::CPU_TIMER);
+	action.type = type;
+	action.a = a;
+	action.b = b;
+
+	Timing::add_event(action_func, (Timing::UnitCycle)0, pack_action(action), Timing::CPU_TIMER);
+}
+
+void initialize(Config::SystemInfo& config)
 {
 	//Indicate the gamepad is connected
 	LoopyIO::set_controller_plugged(true, false);
+
+	action_func = Timing::register_func("Input::action_event", action_event);
+
+	const fs::path& playback_path = config.emulator.input_playback_path;
+	if (!playback_path.empty())
+	{
+		playback_file.open(playback_path);
+		if (playback_file.is_open())
+		{
+			Log::info("[Input] playing back input from %s", playback_path.string().c_str());
+			playing_back = true;
+			read_next_playback();
+		}
+		else
+		{
+			Log::warn("[Input] couldn't open input playback file %s", playback_path.string().c_str());
+		}
+	}
+
+	const fs::path& record_path = config.emulator.input_record_path;
+	if (!record_path.empty())
+	{
+		record_file.open(record_path);
+		if (record_file.is_open())
+		{
+			Log::info("[Input] recording input to %s", record_path.string().c_str());
+		}
+		else
+		{
+			Log::warn("[Input] couldn't open input record file %s", record_path.string().c_str());
+		}
+	}
 }
 
 void shutdown()
 {
-	//nop
+	record_file.close();
+	playback_file.close();
+	playing_back = false;
+	action_func = {};
 }
 
 void set_controller_state(int button, bool pressed)
@@ -30,7 +190,7 @@ void set_controller_state(int button, bool pressed)
 	}
 
 	PadButton pad_button = binding->second;
-	LoopyIO::update_pad(pad_button, pressed);
+	queue_action(ACTION_PAD, pad_button, pressed);
 }
 
 void set_key_state(int key, bool pressed)
@@ -42,7 +202,7 @@ void set_key_state(int key, bool pressed)
 	}
 
 	PadButton pad_button = binding->second;
-	LoopyIO::update_pad(pad_button, pressed);
+	queue_action(ACTION_PAD, pad_button, pressed);
 }
 
 void set_mouse_button_state(int button, bool pressed)
@@ -50,17 +210,25 @@ void set_mouse_button_state(int button, bool pressed)
 	// TODO: replace the hardcoded 1 and 3 with SDL constants or bindings?
 	if (button == 1)
 	{
-		LoopyIO::update_mouse_buttons(MOUSE_L, pressed);
+		queue_action(ACTION_MOUSE_BUTTONS, MOUSE_L, pressed);
 	}
 	if (button == 3)
 	{
-		LoopyIO::update_mouse_buttons(MOUSE_R, pressed);
+		queue_action(ACTION_MOUSE_BUTTONS, MOUSE_R, pressed);
 	}
 }
 
 void move_mouse(int delta_x, int delta_y)
 {
-	LoopyIO::update_mouse_position(delta_x, delta_y);
+	//Large deltas are split so each part fits in an event's packed parameter
+	while (delta_x || delta_y)
+	{
+		int step_x = std::clamp(delta_x, -0x7FFF, 0x7FFF);
+		int step_y = std::clamp(delta_y, -0x7FFF, 0x7FFF);
+		queue_action(ACTION_MOUSE_MOVE, step_x, step_y);
+		delta_x -= step_x;
+		delta_y -= step_y;
+	}
 }
 
 void add_key_binding(int code, PadButton pad_button)
@@ -73,4 +241,4 @@ void add_controller_binding(int code, PadButton pad_button)
 	controller_bindings.emplace(code, pad_button);
 }
 
-}  // namespace Input
\ No newline at end of file
+}  // namespace Input
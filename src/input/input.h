@@ -1,5 +1,7 @@
 #pragma once
 
+#include <core/config.h>
+
 namespace Input
 {
 
@@ -27,7 +29,7 @@ enum MouseButton
 	MOUSE_R = 0x4000
 };
 
-void initialize();
+void initialize(Config::SystemInfo& config);
 void shutdown();
 
 void set_key_state(int key, bool pressed);
@@ -1,8 +1,10 @@
 #include <SDL2/SDL.h>
+#include <capture/capture.h>
 #include <common/bswp.h>
 #include <common/imgwriter.h>
 #include <core/config.h>
 #include <core/system.h>
+#include <core/timing.h>
 #include <input/input.h>
 #include <log/log.h>
 #include <sound/sound.h>
@@ -39,10 +41,17 @@ struct Screen
 	SDL_Renderer* renderer;
 	SDL_Window* window;
 	SDL_Texture* framebuffer;
-	SDL_Texture* prescaled;
+	Uint32 pixel_format;
+	Video::OutputFormat output_format;
+	bool framebuffer_locked;
+	bool frame_changed = true;
+	bool redraw = true;
+	bool present_unchanged_frames = true;
+	uint16_t background_color;
 	int visible_scanlines = DISPLAY_HEIGHT;
 	int window_int_scale = 1;
 	int prescale = 1;
+	Video::Scaler scaler;
 	bool correct_aspect_ratio;
 	bool crop_overscan;
 	bool antialias;
@@ -74,7 +83,6 @@ void shutdown()
 	SDL_ShowCursor(SDL_ENABLE);
 
 	//Destroy window, then kill SDL2
-	if (screen.prescaled) SDL_DestroyTexture(screen.prescaled);
 	SDL_DestroyTexture(screen.framebuffer);
 	SDL_DestroyRenderer(screen.renderer);
 	SDL_DestroyWindow(screen.window);
@@ -161,7 +169,50 @@ static inline void set_draw_color_16bpp(uint16_t c)
 	SDL_SetRenderDrawColor(screen.renderer, r, g, b, SDL_ALPHA_OPAQUE);
 }
 
-void update(uint16_t* display_output, int visible_scanlines, uint16_t background_color)
+static void lock_framebuffer()
+{
+	void* pixels;
+	int pitch;
+
+	//The core draws each line straight into the texture, so there's nothing to copy or convert when presenting
+	if (SDL_LockTexture(screen.framebuffer, NULL, &pixels, &pitch) == 0)
+	{
+		Video::set_output_target(pixels, pitch, screen.output_format);
+		screen.framebuffer_locked = true;
+	}
+}
+
+//Scales the whole display output into the framebuffer on the CPU, which replaces drawing into it line by line
+static void scale_framebuffer()
+{
+	void* pixels;
+	int pitch;
+
+	if (SDL_LockTexture(screen.framebuffer, NULL, &pixels, &pitch) == 0)
+	{
+		Video::scale_display_output(pixels, pitch, screen.output_format, screen.scaler, screen.prescale);
+		SDL_UnlockTexture(screen.framebuffer);
+	}
+}
+
+void begin_frame()
+{
+	//After an unchanged frame the texture already holds the image, so it's only locked if this frame changes it
+	//A prescaled framebuffer is written all at once when the frame is uploaded instead
+	if (screen.prescale == 1 && (screen.frame_changed || screen.redraw))
+	{
+		lock_framebuffer();
+	}
+}
+
+//Forces the next frame to be uploaded and presented, for when the window or renderer lost what was shown
+void redraw()
+{
+	screen.redraw = true;
+}
+
+//Uploads or scales, and presents the frame, or skips what an unchanged frame doesn't need
+void update(int visible_scanlines, uint16_t background_color, bool changed)
 {
 	if (visible_scanlines != screen.visible_scanlines)
 	{
@@ -172,26 +223,37 @@ void update(uint16_t* display_output, int visible_scanlines, uint16_t background
 		}
 	}
 
-	void* pixels;
-	int pitch;
+	if (background_color != screen.background_color)
+	{
+		screen.background_color = background_color;
+		screen.redraw = true;
+	}
 
-	// More efficient alternative to SDL_UpdateTexture(screen.texture, NULL, display_output, sizeof(uint16_t) * DISPLAY_WIDTH);
-	if (SDL_LockTexture(screen.framebuffer, NULL, &pixels, &pitch) == 0)
+	bool upload = changed || screen.redraw;
+	if (upload && screen.prescale > 1)
+	{
+		scale_framebuffer();
+	}
+	else if (upload && !screen.framebuffer_locked)
 	{
-		memcpy(pixels, display_output, sizeof(uint16_t) * DISPLAY_WIDTH * DISPLAY_HEIGHT);
+		lock_framebuffer();
+		Video::copy_to_output_target();
+	}
+
+	if (screen.framebuffer_locked)
+	{
+		Video::set_output_target(nullptr, 0, screen.output_format);
 		SDL_UnlockTexture(screen.framebuffer);
+		screen.framebuffer_locked = false;
 	}
+	screen.frame_changed = changed;
 
-	// Prescale
-	if (screen.prescaled)
+	if (!upload && !screen.present_unchanged_frames)
 	{
-		SDL_SetRenderTarget(screen.renderer, screen.prescaled);
-		SDL_RenderClear(screen.renderer);
-		SDL_RenderCopy(screen.renderer, screen.framebuffer, NULL, NULL);
+		return;
 	}
+	screen.redraw = false;
 
-	// Change target back to screen (must be done before querying renderer output size!)
-	SDL_SetRenderTarget(screen.renderer, NULL);
 	set_draw_color_16bpp(background_color);
 	SDL_RenderClear(screen.renderer);
 
@@ -206,7 +268,8 @@ void update(uint16_t* display_output, int visible_scanlines, uint16_t background
 	float scale = SDL_min(scale_x, scale_y);
 	if (!screen.antialias && !screen.correct_aspect_ratio)
 	{
-		scale = SDL_floorf(scale);
+		//Integer scaling is in display pixels, not texture pixels
+		scale = SDL_floorf(scale * screen.prescale) / screen.prescale;
 	}
 	scale_x = scale_y = scale;
 	if (screen.correct_aspect_ratio)
@@ -220,7 +283,7 @@ void update(uint16_t* display_output, int visible_scanlines, uint16_t background
 	dest.w = w;
 	dest.h = h;
 
-	SDL_RenderCopy(screen.renderer, (screen.prescaled ? screen.prescaled : screen.framebuffer), &src, &dest);
+	SDL_RenderCopy(screen.renderer, screen.framebuffer, &src, &dest);
 	SDL_RenderPresent(screen.renderer);
 }
 
@@ -243,8 +306,13 @@ void initialize(Options::Args& args)
 	screen.correct_aspect_ratio = args.correct_aspect_ratio;
 	screen.crop_overscan = args.crop_overscan;
 	screen.antialias = args.antialias;
+	screen.present_unchanged_frames = args.present_unchanged_frames;
 	screen.window_int_scale = std::clamp(args.int_scale, 1, MAX_WINDOW_INT_SCALE);
-	screen.prescale = args.antialias ? PRESCALE_FACTOR : 1;
+	screen.scaler = args.scaler;
+	screen.prescale = Video::get_scale_factor(args.scaler, args.antialias ? PRESCALE_FACTOR : 1);
+	screen.output_format = args.output_format;
+	screen.pixel_format = (args.output_format == Video::OutputFormat::RGB565) ? SDL_PIXELFORMAT_RGB565
+																				: SDL_PIXELFORMAT_ARGB8888;
 
 	char title[64];
 	snprintf(title, sizeof(title), "%s %s", PROJECT_DESCRIPTION, PROJECT_VERSION);
@@ -260,21 +328,13 @@ void initialize(Options::Args& args)
 
 	screen.renderer = SDL_CreateRenderer(screen.window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 
+	//Antialiasing filters the prescaled framebuffer linearly, so each display pixel keeps a sharp interior
 	screen.framebuffer = SDL_CreateTexture(
-		screen.renderer, SDL_PIXELFORMAT_ARGB1555, SDL_TEXTUREACCESS_STREAMING, DISPLAY_WIDTH, DISPLAY_HEIGHT
+		screen.renderer, screen.pixel_format, SDL_TEXTUREACCESS_STREAMING, DISPLAY_WIDTH * screen.prescale,
+		DISPLAY_HEIGHT * screen.prescale
 	);
 	SDL_SetTextureBlendMode(screen.framebuffer, SDL_BLENDMODE_BLEND);
-	SDL_SetTextureScaleMode(screen.framebuffer, SDL_ScaleModeNearest);
-
-	if (screen.prescale > 1)
-	{
-		screen.prescaled = SDL_CreateTexture(
-			screen.renderer, SDL_PIXELFORMAT_ARGB1555, SDL_TEXTUREACCESS_TARGET, DISPLAY_WIDTH * screen.prescale,
-			DISPLAY_HEIGHT * screen.prescale
-		);
-		SDL_SetTextureBlendMode(screen.prescaled, SDL_BLENDMODE_BLEND);
-		SDL_SetTextureScaleMode(screen.prescaled, SDL_ScaleModeBest);
-	}
+	SDL_SetTextureScaleMode(screen.framebuffer, screen.antialias ? SDL_ScaleModeBest : SDL_ScaleModeNearest);
 
 	// Allow dropping a ROM onto the window
 	SDL_EventState(SDL_DROPFILE, SDL_ENABLE);
@@ -413,6 +473,13 @@ int main(int argc, char** argv)
 	config.emulator.screenshot_image_type = args.screenshot_image_type;
 	config.emulator.printer_image_type = args.printer_image_type;
 	config.emulator.printer_view_command = args.printer_view_command;
+	config.emulator.threaded_render = args.threaded_render;
+	config.emulator.deferred_render_threads = args.deferred_render_threads;
+	config.emulator.threaded_timing = args.threaded_timing;
+	config.emulator.timing_max_skew = args.timing_max_skew;
+	config.emulator.write_log_size = args.write_log_size;
+	config.emulator.input_record_path = args.input_record;
+	config.emulator.input_playback_path = args.input_playback;
 
 	Log::set_level(args.verbose ? Log::VERBOSE : Log::INFO);
 
@@ -482,6 +549,10 @@ int main(int argc, char** argv)
 	constexpr int framerate_max_lag = 5;
 	int last_frame_ticks = SDL_GetPerformanceCounter();
 
+	//With a fixed frameskip, this many frames are emulated without being drawn or shown between each shown frame
+	int frames_to_skip = std::max(args.frameskip, 0);
+	int frames_since_shown = frames_to_skip;
+
 	while (!has_quit)
 	{
 		//Check how much time passed since we drew the last frame
@@ -494,22 +565,54 @@ int main(int argc, char** argv)
 		int draw_frames = ticks_since_last_frame / ticks_per_frame;
 		last_frame_ticks += draw_frames * ticks_per_frame;
 
+		//Audio isn't recorded while the emulator isn't running, as there are no frames to go with it
+		bool running = !is_paused && config.cart.is_loaded();
+		Capture::set_paused(!running);
+
 		//If too far behind, draw one frame and start timing again from now
 		if (draw_frames > framerate_max_lag)
 		{
 			Log::warn("%d frames behind, skipping ahead...", draw_frames);
 			last_frame_ticks = now_ticks;
+
+			//The audio carried on meanwhile, so the recording repeats the last frame for the ones skipped
+			if (running)
+			{
+				Capture::repeat_frames(draw_frames - 1);
+			}
 			draw_frames = 1;
 		}
 
-		if (draw_frames && !is_paused && config.cart.is_loaded())
+		if (draw_frames && running)
 		{
+			bool shown = false;
+			bool changed = false;
 			while (draw_frames > 0)
 			{
-				System::run();
 				draw_frames--;
+
+				//Only the last frame of a catch-up batch can be shown. With frameskip on, the others aren't drawn.
+				bool show = !draw_frames && frames_since_shown >= frames_to_skip;
+				Video::set_skip_render(!show && args.frameskip != 0);
+				if (show)
+				{
+					SDL::begin_frame();
+				}
+
+				System::run();
+				changed |= Video::is_frame_changed();
+
+				//Every emulated frame is recorded so the video keeps time with the audio, and skipped ones repeat the
+				//last frame drawn
+				Capture::push_frame(Video::get_display_output());
+				frames_since_shown = show ? 0 : frames_since_shown + 1;
+				shown |= show;
+			}
+
+			if (shown)
+			{
+				SDL::update(Video::get_display_scanlines(), Video::get_background_color(), changed);
 			}
-			SDL::update(System::get_display_output(), Video::get_display_scanlines(), Video::get_background_color());
 		}
 
 		SDL_Event e;
@@ -520,6 +623,10 @@ int main(int argc, char** argv)
 			case SDL_QUIT:
 				has_quit = true;
 				break;
+			case SDL_RENDER_TARGETS_RESET:
+			case SDL_RENDER_DEVICE_RESET:
+				SDL::redraw();
+				break;
 			case SDL_KEYDOWN:
 				Input::set_key_state(e.key.keysym.sym, true);
 				break;
@@ -528,8 +635,56 @@ int main(int argc, char** argv)
 				SDL_Keycode keycode = e.key.keysym.sym;
 				switch (keycode)
 				{
+				case SDLK_F9:
+					if (e.key.keysym.mod & KMOD_CTRL)
+					{
+						//Event traces are replayed against both scheduler queues by the timingbench tool
+						if (Timing::is_tracing())
+						{
+							Timing::stop_trace();
+						}
+						else if (config.cart.is_loaded())
+						{
+							fs::path trace_filename(imagew::make_unique_name("loopymse_events_", ".lptrace"));
+							Timing::start_trace(config.emulator.image_save_directory / trace_filename);
+						}
+					}
+					else if (Capture::is_active())
+					{
+						Sound::set_output_callback(nullptr);
+						Capture::stop();
+					}
+					else if (config.cart.is_loaded())
+					{
+						//The audio device is opened at the target rate, with SDL converting if the hardware differs
+						fs::path capture_path = config.emulator.image_save_directory;
+						capture_path /= imagew::make_unique_name("loopymse_capture_");
+						if (Capture::start(capture_path, Sound::TARGET_SAMPLE_RATE))
+						{
+							Sound::set_output_callback(Capture::push_audio);
+						}
+					}
+					break;
 				case SDLK_F10:
-					if (config.cart.is_loaded())
+					if (config.cart.is_loaded() && (e.key.keysym.mod & KMOD_SHIFT))
+					{
+						//State dumps can be replayed by the vdpbench tool, or sent to real hardware
+						fs::path dump_filename(imagew::make_unique_name("loopymse_", ".lpstate"));
+
+						Log::info("Saving VDP state to %s", dump_filename.string().c_str());
+						Video::dump_for_serial(config.emulator.image_save_directory / dump_filename);
+					}
+					else if (config.cart.is_loaded() && (e.key.keysym.mod & KMOD_CTRL))
+					{
+						bool json = args.write_log_format == Video::WriteLogFormat::JSON;
+						fs::path log_filename(imagew::make_unique_name("loopymse_writes_", json ? ".json" : ".csv"));
+
+						Log::info("Saving VDP write log to %s", log_filename.string().c_str());
+						Video::export_write_log(
+							config.emulator.image_save_directory / log_filename, args.write_log_format
+						);
+					}
+					else if (config.cart.is_loaded())
 					{
 						int screenshot_image_type = config.emulator.screenshot_image_type;
 						fs::path screenshot_filename(imagew::make_unique_name("loopymse_"));
@@ -606,6 +761,10 @@ int main(int argc, char** argv)
 			case SDL_WINDOWEVENT:
 				switch (e.window.event)
 				{
+				case SDL_WINDOWEVENT_EXPOSED:
+				case SDL_WINDOWEVENT_SIZE_CHANGED:
+					SDL::redraw();
+					break;
 				case SDL_WINDOWEVENT_FOCUS_GAINED:
 					if (!args.run_in_background)
 					{
@@ -691,6 +850,9 @@ int main(int argc, char** argv)
 		}
 	}
 
+	Sound::set_output_callback(nullptr);
+	Capture::stop();
+
 	System::shutdown(config);
 	SDL::shutdown();
 
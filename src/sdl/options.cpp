@@ -2,6 +2,7 @@
 
 #include <SDL2/SDL.h>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 
@@ -17,6 +18,47 @@ namespace Options
 
 static po::options_description commandline_opts = po::options_description("Usage");
 
+constexpr static int MAX_FRAMESKIP = 9;
+
+static int parse_frameskip(const std::string& value)
+{
+	if (value == "auto")
+	{
+		return FRAMESKIP_AUTO;
+	}
+
+	try
+	{
+		return std::clamp(std::stoi(value), 0, MAX_FRAMESKIP);
+	}
+	catch (const std::exception&)
+	{
+		Log::warn("Could not parse frameskip '%s', expected 0-%d or auto", value.c_str(), MAX_FRAMESKIP);
+		return 0;
+	}
+}
+
+static Video::Scaler parse_scaler(const std::string& value)
+{
+	if (value == "scale2x")
+	{
+		return Video::Scaler::SCALE2X;
+	}
+	if (value == "scale3x")
+	{
+		return Video::Scaler::SCALE3X;
+	}
+	if (value == "scanlines")
+	{
+		return Video::Scaler::SCANLINES;
+	}
+	if (value != "nearest")
+	{
+		Log::warn("Could not parse scaler '%s', expected nearest, scale2x, scale3x or scanlines", value.c_str());
+	}
+	return Video::Scaler::NEAREST;
+}
+
 void print_usage()
 {
 	std::cout << commandline_opts << std::endl;
@@ -59,6 +101,8 @@ void parse_commandline(int argc, char** argv, Args& args)
 		("bios", po::value<std::string>(), "Path to Loopy BIOS file")
 		("sound_bios", po::value<std::string>(), "Path to Loopy sound BIOS file")
 		("verbose,v", "Enable verbose logging output")
+		("input_record", po::value<std::string>(), "Record input to a file for later playback")
+		("input_playback", po::value<std::string>(), "Play back input recorded with --input_record")
 		("cart", po::value<std::string>(), "Cartridge to load (--cart can be omitted, use path to ROM as first positional argument)" );
 
 	po::variables_map vm;
@@ -87,6 +131,8 @@ void parse_commandline(int argc, char** argv, Args& args)
 	if (vm.count("bios")) args.bios = vm["bios"].as<std::string>();
 	if (vm.count("sound_bios")) args.sound_bios = vm["sound_bios"].as<std::string>();
 	if (vm.count("cart")) args.cart = vm["cart"].as<std::string>();
+	if (vm.count("input_record")) args.input_record = vm["input_record"].as<std::string>();
+	if (vm.count("input_playback")) args.input_playback = vm["input_playback"].as<std::string>();
 	args.verbose = vm.count("verbose");
 }
 
@@ -151,7 +197,17 @@ bool parse_config(fs::path config_path, Args& args)
 		("emulator.correct_aspect_ratio", po::value<bool>()->default_value(true), "Stretch display pixels to 4:3")
 		("emulator.crop_overscan", po::value<bool>()->default_value(true), "Crop border and overscan areas")
 		("emulator.antialias", po::value<bool>()->default_value(true), "Apply AA (recommended when used with aspect ratio correction)")
-		("emulator.screenshot_image_type", po::value<std::string>()->default_value("bmp"), "Image file type for screenshots");
+		("emulator.screenshot_image_type", po::value<std::string>()->default_value("bmp"), "Image file type for screenshots")
+		("emulator.frameskip", po::value<std::string>()->default_value("0"), "Frames to skip drawing between shown frames, or auto to skip when running behind")
+		("emulator.present_unchanged_frames", po::value<bool>()->default_value(true), "Present frames identical to the last one (disable to save power on static screens)")
+		("emulator.scaler", po::value<std::string>()->default_value("nearest"), "CPU scaler for the display texture (nearest, scale2x, scale3x or scanlines)")
+		("emulator.texture_format", po::value<std::string>()->default_value("argb8888"), "Pixel format of the display texture (argb8888 or rgb565)")
+		("emulator.threaded_render", po::value<bool>()->default_value(false), "Draw scanlines on a separate thread")
+		("emulator.deferred_render_threads", po::value<int>()->default_value(0), "Threads drawing each frame in bands at VSYNC (0 = off)")
+		("emulator.threaded_timing", po::value<bool>()->default_value(false), "Run the sound synth's timing domain on a separate thread")
+		("emulator.timing_max_skew", po::value<int>()->default_value(0), "Cycles threaded timing domains may drift from the CPU (0 = lockstep)")
+		("emulator.write_log_size", po::value<int>()->default_value(0), "VDP writes kept in the write log, exported with Ctrl+F10 (0 = off)")
+		("emulator.write_log_format", po::value<std::string>()->default_value("csv"), "File format of the exported write log (csv or json)");
 
 	po::options_description printer_options("Printer");
 	printer_options.add_options()
@@ -180,6 +236,19 @@ bool parse_config(fs::path config_path, Args& args)
 		args.antialias = vm["emulator.antialias"].as<bool>();
 		args.crop_overscan = vm["emulator.crop_overscan"].as<bool>();
 		args.int_scale = vm["emulator.int_scale"].as<int>();
+		args.threaded_render = vm["emulator.threaded_render"].as<bool>();
+		args.deferred_render_threads = std::max(0, vm["emulator.deferred_render_threads"].as<int>());
+		args.threaded_timing = vm["emulator.threaded_timing"].as<bool>();
+		args.timing_max_skew = std::max(0, vm["emulator.timing_max_skew"].as<int>());
+		args.write_log_size = std::max(0, vm["emulator.write_log_size"].as<int>());
+		args.write_log_format = (vm["emulator.write_log_format"].as<std::string>() == "json")
+									? Video::WriteLogFormat::JSON
+									: Video::WriteLogFormat::CSV;
+		args.frameskip = parse_frameskip(vm["emulator.frameskip"].as<std::string>());
+		args.present_unchanged_frames = vm["emulator.present_unchanged_frames"].as<bool>();
+		args.output_format = (vm["emulator.texture_format"].as<std::string>() == "rgb565") ? Video::OutputFormat::RGB565
+																							: Video::OutputFormat::ARGB8888;
+		args.scaler = parse_scaler(vm["emulator.scaler"].as<std::string>());
 		args.screenshot_image_type = imagew::parse_image_type(
 			vm["emulator.screenshot_image_type"].as<std::string>(), imagew::IMAGE_TYPE_DEFAULT
 		);
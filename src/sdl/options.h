@@ -1,12 +1,16 @@
 #pragma once
 #include <boost/program_options.hpp>
 #include <filesystem>
+#include <video/video.h>
 
 namespace fs = std::filesystem;
 
 namespace Options
 {
 
+//Skips drawing every frame that won't be presented, instead of a fixed number between presented frames
+constexpr static int FRAMESKIP_AUTO = -1;
+
 struct Args
 {
 	std::string cart;
@@ -20,6 +24,18 @@ struct Args
 	bool verbose;
 	int int_scale = 2;
 	int screenshot_image_type;
+	Video::OutputFormat output_format = Video::OutputFormat::ARGB8888;
+	Video::Scaler scaler = Video::Scaler::NEAREST;
+	int frameskip = 0;
+	bool present_unchanged_frames = true;
+	bool threaded_render = false;
+	int deferred_render_threads = 0;
+	bool threaded_timing = false;
+	int timing_max_skew = 0;
+	int write_log_size = 0;
+	Video::WriteLogFormat write_log_format = Video::WriteLogFormat::CSV;
+	std::string input_record;
+	std::string input_playback;
 
 	int printer_image_type;
 	std::string printer_view_command;
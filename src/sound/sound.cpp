@@ -35,6 +35,12 @@ namespace Sound
 static Timing::FuncHandle timeref_func;
 static Timing::EventHandle timeref_ev;
 
+//The synth is a timing domain of its own, so that it can run on a separate thread. MIDI input and control register
+//writes reach it as events, on the cycle the CPU sent them.
+static int32_t timer_cycles_left;
+static Timing::FuncHandle midi_func;
+static Timing::FuncHandle ctrl_func;
+
 static std::unique_ptr<LoopySound::LoopySound> sound_engine;
 
 static int sample_rate;
@@ -55,6 +61,8 @@ static SDL_AudioStream* wav_stream = NULL;
 static std::vector<uint8_t> wav_buf;
 static float wav_volume = 1;
 
+static OutputCallback output_callback;
+
 static void sdl_audio_callback(void* userdata, uint8_t* raw_buffer, int len)
 {
 	float* sample_buffer = (float*)raw_buffer;
@@ -77,6 +85,11 @@ static void sdl_audio_callback(void* userdata, uint8_t* raw_buffer, int len)
 			);
 		}
 	}
+
+	if (output_callback)
+	{
+		output_callback(sample_buffer, sample_count);
+	}
 }
 
 static bool sdl_audio_initialize()
@@ -122,14 +135,35 @@ static void sdl_audio_shutdown()
 {
 	// Close audio device
 	if (audio_device) SDL_CloseAudioDevice(audio_device);
+	audio_device = 0;
+}
+
+void set_output_callback(OutputCallback callback)
+{
+	// Locking the device keeps the audio callback from running while it's swapped
+	if (audio_device) SDL_LockAudioDevice(audio_device);
+	output_callback = callback;
+	if (audio_device) SDL_UnlockAudioDevice(audio_device);
 }
 
 /* SDL-specific code end */
 
 static void timeref(uint64_t param, int cycles_late);
+static void midi_in(uint64_t param, int cycles_late);
+static void set_control(uint64_t param, int cycles_late);
+
+static void run_timer()
+{
+	//The synth has no instructions to run, only the events scheduled for it
+	timer_cycles_left = 0;
+}
 
 void initialize(std::vector<uint8_t>& sound_rom)
 {
+	Timing::register_timer(Timing::SOUND_TIMER, &timer_cycles_left, run_timer, true);
+	midi_func = Timing::register_func("Sound::midi_in", midi_in);
+	ctrl_func = Timing::register_func("Sound::set_control", set_control);
+
 	if (!sound_rom.empty())
 	{
 		if (!sdl_audio_initialize())
@@ -188,7 +222,7 @@ void ctrl_write16(uint32_t addr, uint16_t value)
 	value &= 0xFFF;
 	if (sound_engine)
 	{
-		sound_engine->set_control_register(value);
+		Timing::add_event(ctrl_func, (Timing::UnitCycle)0, value, Timing::SOUND_TIMER);
 	}
 }
 
@@ -203,7 +237,7 @@ void midi_byte_in(uint8_t value)
 	//fflush(stdout);
 	if (sound_engine)
 	{
-		sound_engine->midi_in((char)value);
+		Timing::add_event(midi_func, (Timing::UnitCycle)0, value, Timing::SOUND_TIMER);
 	}
 }
 
@@ -217,12 +251,22 @@ static void timeref(uint64_t param, int cycles_late)
 {
 	constexpr static int cycles_per_timeref = Timing::F_CPU / TIMEREF_FREQUENCY;
 	Timing::UnitCycle timeref_cycles = Timing::convert_cpu(cycles_per_timeref - cycles_late);
-	timeref_ev = Timing::add_event(timeref_func, timeref_cycles, 0, Timing::CPU_TIMER);
+	timeref_ev = Timing::add_event(timeref_func, timeref_cycles, 0, Timing::SOUND_TIMER);
 
 	constexpr static float timeref_period = 1.f / TIMEREF_FREQUENCY;
 	sound_engine->time_reference(timeref_period);
 }
 
+static void midi_in(uint64_t param, int cycles_late)
+{
+	sound_engine->midi_in((char)param);
+}
+
+static void set_control(uint64_t param, int cycles_late)
+{
+	sound_engine->set_control_register((int)param);
+}
+
 static void update_volume_level()
 {
 	if (MUTE_FADE_MS > 0)
@@ -59,4 +59,9 @@ void set_mute(bool mute_in);
 void wav_queue(std::string path, float volume);
 void wav_stop();
 
+// Receives each buffer of interleaved stereo samples as sent to the audio device, at TARGET_SAMPLE_RATE.
+// Runs on the audio thread, so it must not block. Setting it waits for any call in progress to return.
+typedef void (*OutputCallback)(const float* samples, uint32_t count);
+void set_output_callback(OutputCallback callback);
+
 }  // namespace Sound
@@ -0,0 +1,112 @@
+#include <core/memory.h>
+#include <core/timing.h>
+#include <log/log.h>
+#include <video/video.h>
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+/*
+ * Checks that lines outside the visible area aren't reused with stale contents. A static screen is drawn with extra
+ * scanlines on, then off, which leaves the border color and a cleared area below the active area, and then on again.
+ * Nothing the lines are drawn with changes in between, so the bottom lines must be drawn again rather than reused.
+ */
+
+using Video::DISPLAY_WIDTH;
+
+constexpr static int ACTIVE_SCANLINES = 0xE0;
+constexpr static int EXTRA_SCANLINES = 0xF0;
+
+//Stands in for the CPU, which just lets every slice go by
+static int32_t cycles_left;
+
+static void run_frame()
+{
+	Video::start_frame();
+	while (!Video::check_frame_end())
+	{
+		Timing::process_slice(Timing::CPU_TIMER, Timing::calc_slice_length(Timing::CPU_TIMER));
+	}
+}
+
+//Frames are run a few times after each change, as the first one after a MODE write may only cover part of the screen
+static void run_frames()
+{
+	for (int i = 0; i < 3; i++)
+	{
+		run_frame();
+	}
+}
+
+static void set_extra_scanlines(bool enable)
+{
+	Video::ctrl_write16(0x000, enable ? 0x2 : 0x0);
+}
+
+static const uint16_t* get_line(int y)
+{
+	return Video::get_display_output() + y * DISPLAY_WIDTH;
+}
+
+int main()
+{
+	Log::set_level(Log::WARN);
+
+	std::vector<uint8_t> bios(Memory::BIOS_SIZE);
+	Memory::initialize(bios);
+	Timing::initialize();
+	Timing::register_timer(Timing::CPU_TIMER, &cycles_left, [] { cycles_left = 0; });
+	Video::initialize();
+
+	//Writes are made at the end of a frame, where they don't split a line
+	run_frame();
+
+	//Only screen B is output, so the lines are drawn in backdrop B and the border line in backdrop A
+	Video::display_write16(0x004, 0x20);
+	Video::display_write16(0x006, 0x03E0);
+	Video::display_write16(0x008, 0x7C00);
+	set_extra_scanlines(true);
+	run_frames();
+
+	std::vector<uint16_t> expected(get_line(0), get_line(1));
+	int failures = 0;
+	for (int y = ACTIVE_SCANLINES; y < EXTRA_SCANLINES; y++)
+	{
+		if (memcmp(get_line(y), expected.data(), DISPLAY_WIDTH * sizeof(uint16_t)))
+		{
+			printf("line %d isn't drawn with extra scanlines on\n", y);
+			failures++;
+		}
+	}
+
+	set_extra_scanlines(false);
+	run_frames();
+
+	//Only make sure the bottom lines were overwritten, or there's nothing stale to reuse
+	if (!memcmp(get_line(ACTIVE_SCANLINES), expected.data(), DISPLAY_WIDTH * sizeof(uint16_t)) ||
+		!memcmp(get_line(ACTIVE_SCANLINES + 1), expected.data(), DISPLAY_WIDTH * sizeof(uint16_t)))
+	{
+		printf("lines below the active area weren't overwritten with extra scanlines off\n");
+		failures++;
+	}
+
+	set_extra_scanlines(true);
+	run_frames();
+
+	for (int y = ACTIVE_SCANLINES; y < EXTRA_SCANLINES; y++)
+	{
+		if (memcmp(get_line(y), expected.data(), DISPLAY_WIDTH * sizeof(uint16_t)))
+		{
+			printf("line %d wasn't drawn again after extra scanlines were turned back on\n", y);
+			failures++;
+		}
+	}
+
+	Video::shutdown();
+	Timing::shutdown();
+	Memory::shutdown();
+
+	printf("%s\n", failures ? "FAILED" : "Lines below the active area are drawn again");
+	return failures ? 1 : 0;
+}
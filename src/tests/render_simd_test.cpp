@@ -0,0 +1,251 @@
+#include <video/render_simd.h>
+#include <video/video.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+/*
+ * Checks that every SIMD implementation of the renderer's line helpers gives bit-identical results to the scalar one.
+ * Each helper is run under every implementation the host supports on the same random input, at random counts and
+ * unaligned addresses, and the outputs are compared against the scalar output.
+ */
+
+namespace SIMD = Video::Renderer::SIMD;
+
+using Video::DISPLAY_WIDTH;
+using Video::MAX_SCALE_FACTOR;
+
+constexpr static int ITERATIONS = 2000;
+
+//Room for the widest scaled line, plus padding for unaligned starts and the scalers' neighbor pixels
+constexpr static int BUFFER_SIZE = DISPLAY_WIDTH * MAX_SCALE_FACTOR + 64;
+
+static std::mt19937 rng(0x100B7);
+
+static int random_int(int min, int max)
+{
+	return std::uniform_int_distribution<int>(min, max)(rng);
+}
+
+//Mostly random bytes, with runs of zeros so both the transparent and opaque paths are covered
+static void fill_indices(std::vector<uint8_t>& data)
+{
+	int zero_chance = random_int(0, 100);
+	for (uint8_t& value : data)
+	{
+		value = (random_int(0, 99) < zero_chance) ? 0 : random_int(0, 255);
+	}
+}
+
+//Either any RGB555 color, or a few colors, so the scalers see pixels that match their neighbors
+static void fill_colors(std::vector<uint16_t>& data)
+{
+	uint16_t palette[3] = {(uint16_t)random_int(0, 0xFFFF), (uint16_t)random_int(0, 0xFFFF),
+						   (uint16_t)random_int(0, 0xFFFF)};
+	bool few_colors = random_int(0, 1);
+	for (uint16_t& value : data)
+	{
+		value = few_colors ? palette[random_int(0, 2)] : random_int(0, 0xFFFF);
+	}
+}
+
+//Input for one iteration, shared by every implementation
+struct Input
+{
+	std::vector<uint16_t> colors[3];
+	std::vector<uint8_t> indices[2];
+	int offset;
+	int count;
+	int bytes;
+	int factor;
+	uint8_t subpalette_bits;
+	uint8_t mask;
+	uint8_t value;
+};
+
+//Everything the helpers write, compared between implementations
+struct Output
+{
+	std::vector<uint16_t> colors;
+	std::vector<uint16_t> scaled[MAX_SCALE_FACTOR];
+	std::vector<uint32_t> argb;
+	std::vector<uint8_t> indices;
+	uint64_t mask[DISPLAY_WIDTH / 64];
+	bool changed;
+
+	bool operator==(const Output& other) const
+	{
+		for (int i = 0; i < MAX_SCALE_FACTOR; i++)
+		{
+			if (scaled[i] != other.scaled[i])
+			{
+				return false;
+			}
+		}
+		return colors == other.colors && argb == other.argb && indices == other.indices &&
+			   !memcmp(mask, other.mask, sizeof(mask)) && changed == other.changed;
+	}
+};
+
+static Input make_input()
+{
+	Input input;
+	for (std::vector<uint16_t>& colors : input.colors)
+	{
+		colors.resize(BUFFER_SIZE);
+		fill_colors(colors);
+	}
+	for (std::vector<uint8_t>& indices : input.indices)
+	{
+		indices.resize(BUFFER_SIZE);
+		fill_indices(indices);
+	}
+
+	input.offset = random_int(1, 31);
+	input.count = random_int(0, DISPLAY_WIDTH);
+	input.bytes = random_int(0, DISPLAY_WIDTH / 2);
+	input.factor = random_int(1, MAX_SCALE_FACTOR);
+	input.subpalette_bits = random_int(0, 15) << 4;
+	input.mask = random_int(0, 255);
+	input.value = random_int(0, 255);
+	return input;
+}
+
+static void clear_output(Output& output)
+{
+	output.colors.assign(BUFFER_SIZE, 0);
+	output.argb.assign(BUFFER_SIZE, 0);
+	for (std::vector<uint16_t>& scaled : output.scaled)
+	{
+		scaled.assign(BUFFER_SIZE, 0);
+	}
+	memset(output.mask, 0, sizeof(output.mask));
+	output.changed = false;
+}
+
+/*
+ * Runs one helper with the current implementation. The output buffers start out the same for every implementation,
+ * holding one of the inputs where the helper reads what it writes to.
+ */
+static void run_helper(int helper, const Input& input, Output& output)
+{
+	clear_output(output);
+	int offset = input.offset;
+	const uint16_t* a = input.colors[0].data() + offset;
+	const uint16_t* b = input.colors[1].data() + offset;
+	const uint16_t* c = input.colors[2].data() + offset;
+	uint16_t* colors = output.colors.data() + offset;
+	uint16_t* const scaled[MAX_SCALE_FACTOR] = {output.scaled[0].data(), output.scaled[1].data(),
+												 output.scaled[2].data(), output.scaled[3].data()};
+
+	switch (helper)
+	{
+	case 0:
+	case 1:
+	case 2:
+	case 3:
+		SIMD::color_math(a, b, colors, helper & 2, helper & 1);
+		break;
+	case 4:
+		SIMD::screen_overlay(a, b, input.indices[0].data() + offset, colors);
+		break;
+	case 5:
+		SIMD::copy_opaque(a, colors);
+		break;
+	case 6:
+		output.indices.assign(BUFFER_SIZE, 0);
+		SIMD::expand_4bpp(input.indices[0].data() + offset, output.indices.data() + offset, input.bytes,
+						  input.subpalette_bits);
+		break;
+	case 7:
+		output.indices = input.indices[1];
+		SIMD::blit_under(input.indices[0].data() + offset, output.indices.data() + offset, input.count);
+		break;
+	case 8:
+		output.indices.clear();
+		SIMD::opaque_mask(input.indices[0].data() + offset, output.mask);
+		break;
+	case 9:
+		output.indices = input.indices[0];
+		output.changed = SIMD::masked_fill(output.indices.data() + offset, input.count, input.mask, input.value);
+		break;
+	case 10:
+		SIMD::to_argb8888(a, output.argb.data() + offset, input.count * input.factor);
+		break;
+	case 11:
+		SIMD::to_rgb565(a, colors, input.count * input.factor);
+		break;
+	case 12:
+		SIMD::scale2x(a, b, c, scaled, input.count);
+		break;
+	case 13:
+		SIMD::scale3x(a, b, c, scaled, input.count);
+		break;
+	case 14:
+		SIMD::repeat_pixels(a, colors, input.count, input.factor);
+		break;
+	case 15:
+		SIMD::darken(a, colors, input.count * input.factor);
+		break;
+	}
+}
+
+//Indexed like the cases in run_helper
+static const char* const HELPER_NAMES[] = {
+	"color_math add", "color_math add half", "color_math subtract", "color_math subtract half",
+	"screen_overlay", "copy_opaque", "expand_4bpp", "blit_under", "opaque_mask", "masked_fill",
+	"to_argb8888", "to_rgb565", "scale2x", "scale3x", "repeat_pixels", "darken"};
+constexpr static int HELPER_COUNT = sizeof(HELPER_NAMES) / sizeof(HELPER_NAMES[0]);
+
+int main()
+{
+	std::vector<const char*> impls = SIMD::get_impl_names();
+	printf("Implementations:");
+	for (const char* impl : impls)
+	{
+		printf(" %s", impl);
+	}
+	printf("\n");
+
+	//The scalar implementation is always last, and is what the others are compared against
+	int simd_impls = impls.size() - 1;
+	std::vector<int> failures(simd_impls * HELPER_COUNT);
+	Output expected, actual;
+	for (int i = 0; i < ITERATIONS; i++)
+	{
+		Input input = make_input();
+		for (int helper = 0; helper < HELPER_COUNT; helper++)
+		{
+			SIMD::set_impl("scalar");
+			run_helper(helper, input, expected);
+
+			for (int impl = 0; impl < simd_impls; impl++)
+			{
+				SIMD::set_impl(impls[impl]);
+				run_helper(helper, input, actual);
+				failures[impl * HELPER_COUNT + helper] += !(actual == expected);
+			}
+		}
+	}
+
+	int failed = 0;
+	for (int impl = 0; impl < simd_impls; impl++)
+	{
+		for (int helper = 0; helper < HELPER_COUNT; helper++)
+		{
+			int count = failures[impl * HELPER_COUNT + helper];
+			if (count)
+			{
+				printf("%s %s: %d of %d iterations differ from scalar\n", impls[impl], HELPER_NAMES[helper], count,
+					   ITERATIONS);
+				failed++;
+			}
+		}
+	}
+
+	printf("%s\n", failed ? "FAILED" : "All implementations match scalar");
+	return failed ? 1 : 0;
+}
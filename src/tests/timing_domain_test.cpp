@@ -0,0 +1,210 @@
+#include <core/timing.h>
+#include <log/log.h>
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/*
+ * Checks that a threaded timing domain sees the same events, in the same order and on the same cycles, as when it
+ * runs on the emulation thread, as long as the skew is zero. Stand-ins for the CPU and the sound synth exchange events
+ * like the serial port and the synth do: the CPU sends bytes at random times, and the synth has a periodic time
+ * reference and answers some of the bytes. The CPU overruns its slices by a few cycles, like the SH2 does.
+ * With some skew allowed the order can differ, but every byte must still arrive, and the synth must stay in bounds.
+ */
+
+constexpr static int64_t RUN_CYCLES = Timing::F_CPU / 4;
+constexpr static int64_t SKEW = 2000;
+constexpr static int TIMEREF_CYCLES = Timing::F_CPU / 240;
+
+struct LogEntry
+{
+	int func;
+	uint64_t param;
+	int64_t timestamp;
+	int cycles_late;
+
+	bool operator==(const LogEntry& other) const
+	{
+		return func == other.func && param == other.param && timestamp == other.timestamp &&
+			   cycles_late == other.cycles_late;
+	}
+};
+
+struct Run
+{
+	std::vector<LogEntry> cpu_log;
+	std::vector<LogEntry> sound_log;
+	int skew_errors;
+};
+
+enum Funcs
+{
+	FUNC_TX,
+	FUNC_ACK,
+	FUNC_RX,
+	FUNC_TIMEREF
+};
+
+static Run* run;
+static std::mt19937 rng;
+static int32_t cpu_cycles_left;
+static int32_t sound_cycles_left;
+static Timing::FuncHandle tx_func;
+static Timing::FuncHandle ack_func;
+static Timing::FuncHandle rx_func;
+static Timing::FuncHandle timeref_func;
+static uint64_t next_byte;
+
+static void log_event(std::vector<LogEntry>& log, int func, uint64_t param, int cycles_late)
+{
+	log.push_back({func, param, Timing::get_timestamp(), cycles_late});
+}
+
+//CPU side: sends a byte and schedules the next one, sometimes on the same cycle
+static void tx(uint64_t param, int cycles_late)
+{
+	log_event(run->cpu_log, FUNC_TX, next_byte, cycles_late);
+	Timing::add_event(rx_func, (Timing::UnitCycle)(rng() % 3 ? 0 : rng() % 64), next_byte, Timing::SOUND_TIMER);
+	next_byte++;
+
+	int64_t delay = (rng() % 8) ? rng() % 4000 : 0;
+	Timing::add_event(tx_func, (Timing::UnitCycle)delay, 0, Timing::CPU_TIMER);
+}
+
+static void ack(uint64_t param, int cycles_late)
+{
+	log_event(run->cpu_log, FUNC_ACK, param, cycles_late);
+}
+
+//Synth side: takes bytes, answering every 8th, and keeps its own time reference
+static void rx(uint64_t param, int cycles_late)
+{
+	log_event(run->sound_log, FUNC_RX, param, cycles_late);
+	if (!(param % 8))
+	{
+		Timing::add_event(ack_func, (Timing::UnitCycle)100, param, Timing::CPU_TIMER);
+	}
+
+	//The synth must never be further ahead of the CPU than it's allowed to be
+	if (Timing::is_threaded(Timing::SOUND_TIMER))
+	{
+		run->skew_errors += Timing::get_timestamp() > Timing::get_timestamp(Timing::CPU_TIMER) + SKEW;
+	}
+}
+
+static void timeref(uint64_t param, int cycles_late)
+{
+	log_event(run->sound_log, FUNC_TIMEREF, param, cycles_late);
+	Timing::add_event(timeref_func, (Timing::UnitCycle)(TIMEREF_CYCLES - cycles_late), param + 1, Timing::SOUND_TIMER);
+}
+
+static Run run_domains(bool threaded, int64_t max_skew)
+{
+	Run result = {};
+	run = &result;
+	rng.seed(0x5EED);
+	next_byte = 0;
+
+	Timing::initialize();
+	Timing::register_timer(Timing::CPU_TIMER, &cpu_cycles_left, [] { cpu_cycles_left = -(int32_t)(rng() % 4); });
+	Timing::register_timer(Timing::SOUND_TIMER, &sound_cycles_left, [] { sound_cycles_left = 0; }, true);
+	tx_func = Timing::register_func("tx", tx);
+	ack_func = Timing::register_func("ack", ack);
+	rx_func = Timing::register_func("rx", rx);
+	timeref_func = Timing::register_func("timeref", timeref);
+
+	Timing::add_event(tx_func, (Timing::UnitCycle)10, 0, Timing::CPU_TIMER);
+	Timing::add_event(timeref_func, (Timing::UnitCycle)TIMEREF_CYCLES, 0, Timing::SOUND_TIMER);
+
+	if (threaded)
+	{
+		Timing::start_domains(max_skew);
+	}
+
+	while (Timing::get_timestamp(Timing::CPU_TIMER) < RUN_CYCLES)
+	{
+		Timing::run_slice();
+	}
+
+	Timing::shutdown();
+	run = nullptr;
+	return result;
+}
+
+static int compare_logs(const char* name, const std::vector<LogEntry>& expected, const std::vector<LogEntry>& actual)
+{
+	if (expected.size() != actual.size())
+	{
+		printf("%s: %zu events instead of %zu\n", name, actual.size(), expected.size());
+		return 1;
+	}
+
+	for (size_t i = 0; i < expected.size(); i++)
+	{
+		if (!(expected[i] == actual[i]))
+		{
+			printf("%s: event %zu is func %d param %llu at %lld, expected func %d param %llu at %lld\n", name, i,
+				   actual[i].func, (unsigned long long)actual[i].param, (long long)actual[i].timestamp,
+				   expected[i].func, (unsigned long long)expected[i].param, (long long)expected[i].timestamp);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//With skew, every byte must still be received once, and never before it was sent
+static int check_bytes(const Run& skewed)
+{
+	std::vector<int64_t> sent_at;
+	for (const LogEntry& entry : skewed.cpu_log)
+	{
+		if (entry.func == FUNC_TX)
+		{
+			sent_at.push_back(entry.timestamp);
+		}
+	}
+
+	std::vector<bool> received(sent_at.size());
+	int count = 0;
+	for (const LogEntry& entry : skewed.sound_log)
+	{
+		if (entry.func != FUNC_RX)
+		{
+			continue;
+		}
+
+		if (entry.param >= sent_at.size() || received[entry.param] || entry.timestamp < sent_at[entry.param])
+		{
+			printf("skewed: byte %llu received twice or before it was sent\n", (unsigned long long)entry.param);
+			return 1;
+		}
+		received[entry.param] = true;
+		count++;
+	}
+
+	if (!count || skewed.skew_errors)
+	{
+		printf("skewed: %d bytes received, synth ran too far ahead %d times\n", count, skewed.skew_errors);
+		return 1;
+	}
+	return 0;
+}
+
+int main()
+{
+	Log::set_level(Log::WARN);
+
+	Run serial = run_domains(false, 0);
+	Run lockstep = run_domains(true, 0);
+	Run skewed = run_domains(true, SKEW);
+
+	int failed = 0;
+	failed += compare_logs("lockstep CPU", serial.cpu_log, lockstep.cpu_log);
+	failed += compare_logs("lockstep synth", serial.sound_log, lockstep.sound_log);
+	failed += check_bytes(skewed);
+
+	printf("%zu CPU and %zu synth events\n", serial.cpu_log.size(), serial.sound_log.size());
+	printf("%s\n", failed ? "FAILED" : "Threaded domains match the emulation thread");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,252 @@
+#include <core/timing_local.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Scheduler queue benchmark. Each event trace recorded by Timing::start_trace is replayed against both event queue
+ * backends, doing the same pushes, pops, cancels and peeks the scheduler did while the game ran. The time each
+ * backend takes is reported, and every pop is checked against the event that ran when the trace was recorded.
+ */
+
+namespace fs = std::filesystem;
+
+using Timing::Event;
+using Timing::TraceEntry;
+
+struct Args
+{
+	std::vector<fs::path> traces;
+	int runs = 5;
+};
+
+//A trace entry with its events numbered, so the replay can find them without a lookup
+struct ReplayOp
+{
+	uint8_t op;
+	uint8_t timer;
+	int64_t exec_time;
+	int64_t id;
+	int event; //PUSH and CANCEL: the event's number, POP: the number of the event expected to run
+};
+
+struct Trace
+{
+	std::vector<ReplayOp> ops;
+	int events;
+	int timers;
+};
+
+//Where peeked times go, so the peeks aren't optimized away
+static volatile int64_t peek_sink;
+
+static void print_usage()
+{
+	printf("Usage: timingbench [options] <trace>...\n");
+	printf("  --runs <n>       Times to replay each trace on each queue, keeping the fastest (default 5)\n");
+}
+
+static bool parse_args(int argc, char** argv, Args& args)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--runs" && has_value)
+		{
+			args.runs = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg.rfind("--", 0) == 0)
+		{
+			return false;
+		}
+		else
+		{
+			args.traces.push_back(arg);
+		}
+	}
+
+	return !args.traces.empty();
+}
+
+//Events are numbered in the order they're pushed. Keys can be reused once an event is gone, but ids can't.
+static bool load_trace(const fs::path& path, Trace& trace)
+{
+	std::ifstream file(path, std::ios::binary);
+	char magic[sizeof(Timing::TRACE_MAGIC)];
+	if (!file.read(magic, sizeof(magic)) || memcmp(magic, Timing::TRACE_MAGIC, sizeof(magic)))
+	{
+		return false;
+	}
+
+	std::unordered_map<int64_t, int> events_by_key[256];
+	std::unordered_map<int64_t, int> events_by_id[256];
+	trace.events = 0;
+	trace.timers = 0;
+
+	TraceEntry entry;
+	while (file.read((char*)&entry, sizeof(entry)))
+	{
+		ReplayOp op = {entry.op, entry.timer, entry.exec_time, entry.id, -1};
+		switch (entry.op)
+		{
+		case Timing::TRACE_PUSH:
+			op.event = trace.events++;
+			events_by_key[entry.timer][entry.key] = op.event;
+			events_by_id[entry.timer][entry.id] = op.event;
+			break;
+		case Timing::TRACE_POP:
+		{
+			auto it = events_by_id[entry.timer].find(entry.id);
+			if (it == events_by_id[entry.timer].end())
+			{
+				return false;
+			}
+			op.event = it->second;
+			break;
+		}
+		case Timing::TRACE_CANCEL:
+		{
+			auto it = events_by_key[entry.timer].find(entry.key);
+			if (it == events_by_key[entry.timer].end())
+			{
+				return false;
+			}
+			op.event = it->second;
+			break;
+		}
+		case Timing::TRACE_PEEK:
+			break;
+		default:
+			return false;
+		}
+
+		trace.timers = std::max(trace.timers, entry.timer + 1);
+		trace.ops.push_back(op);
+	}
+
+	return true;
+}
+
+//Returns the time taken, or a negative value if an event ran out of order
+template <typename Queue> static double replay(const Trace& trace)
+{
+	std::vector<Queue> queues(trace.timers);
+	std::vector<int64_t> keys(trace.events);
+	int64_t next_times = 0;
+	Timing::EventFunc func = [](uint64_t, int) {};
+
+	auto start = std::chrono::steady_clock::now();
+	for (const ReplayOp& op : trace.ops)
+	{
+		Queue& queue = queues[op.timer];
+		switch (op.op)
+		{
+		case Timing::TRACE_PUSH:
+		{
+			Event ev;
+			ev.exec_time = op.exec_time;
+			ev.param = op.event;
+			ev.func = func;
+			ev.id = op.id;
+			keys[op.event] = queue.push(std::move(ev));
+			break;
+		}
+		case Timing::TRACE_POP:
+			if (queue.empty() || (int)queue.pop().param != op.event)
+			{
+				return -1.0;
+			}
+			break;
+		case Timing::TRACE_CANCEL:
+			if (!queue.cancel(keys[op.event]))
+			{
+				return -1.0;
+			}
+			break;
+		case Timing::TRACE_PEEK:
+			if (!queue.empty())
+			{
+				next_times += queue.top().exec_time;
+			}
+			break;
+		}
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	peek_sink = next_times;
+	return elapsed.count();
+}
+
+template <typename Queue> static double best_replay(const Trace& trace, int runs)
+{
+	double best = 0.0;
+	for (int i = 0; i < runs; i++)
+	{
+		double elapsed = replay<Queue>(trace);
+		if (elapsed < 0.0)
+		{
+			return elapsed;
+		}
+		best = (i == 0) ? elapsed : std::min(best, elapsed);
+	}
+	return best;
+}
+
+//Returns whether both queues ran every event in the recorded order
+static bool run_trace(const Args& args, const fs::path& path)
+{
+	Trace trace;
+	if (!load_trace(path, trace))
+	{
+		printf("%s: not a valid event trace\n", path.string().c_str());
+		return false;
+	}
+
+	double heap = best_replay<Timing::EventHeap>(trace, args.runs);
+	double wheel = best_replay<Timing::EventWheel>(trace, args.runs);
+	double ops = trace.ops.size();
+
+	printf("%s: %zu operations, %d events\n", path.string().c_str(), trace.ops.size(), trace.events);
+	if (heap < 0.0 || wheel < 0.0)
+	{
+		printf("  %s ran events out of the recorded order\n", (heap < 0.0) ? "heap" : "wheel");
+		return false;
+	}
+
+	printf("  heap:  %.3fs, %.1f ns/op\n", heap, heap * 1e9 / ops);
+	printf("  wheel: %.3fs, %.1f ns/op\n", wheel, wheel * 1e9 / ops);
+	printf("  %s is %.0f%% faster\n", (heap <= wheel) ? "heap" : "wheel",
+		   (std::max(heap, wheel) / std::min(heap, wheel) - 1.0) * 100.0);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	Args args;
+	if (!parse_args(argc, argv, args))
+	{
+		print_usage();
+		return 2;
+	}
+
+	int failed = 0;
+	for (const fs::path& trace : args.traces)
+	{
+		failed += !run_trace(args, trace);
+	}
+
+	if (failed)
+	{
+		printf("%d of %d traces failed\n", failed, (int)args.traces.size());
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,214 @@
+#include <common/imgwriter.h>
+#include <core/memory.h>
+#include <core/timing.h>
+#include <log/log.h>
+#include <video/render.h>
+#include <video/render_simd.h>
+#include <video/video.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+ * Headless renderer benchmark and conformance check. Each state dump written by Video::dump_for_serial is loaded into
+ * a fresh VDP and drawn for a number of frames, without the CPU, BIOS, cart or SDL. The lines drawn per second are
+ * reported, and a hash of the final image is compared against the golden hash stored next to the dump.
+ */
+
+namespace imagew = Common::ImageWriter;
+namespace fs = std::filesystem;
+
+using Video::DISPLAY_WIDTH;
+
+struct Args
+{
+	std::vector<fs::path> dumps;
+	int frames = 300;
+	bool threaded = false;
+	int deferred_threads = 0;
+	bool reuse_lines = false;
+	bool update = false;
+};
+
+static void print_usage()
+{
+	printf("Usage: vdpbench [options] <dump>...\n");
+	printf("  --frames <n>     Frames to draw of each dump (default 300)\n");
+	printf("  --threaded       Draw lines on the render thread\n");
+	printf("  --deferred <n>   Draw frames in bands across n threads\n");
+	printf("  --reuse-lines    Let unchanged lines be reused, instead of drawing every line of every frame\n");
+	printf("  --update         Write the golden hash and image of each dump instead of checking them\n");
+}
+
+static bool parse_args(int argc, char** argv, Args& args)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--frames" && has_value)
+		{
+			args.frames = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--threaded")
+		{
+			args.threaded = true;
+		}
+		else if (arg == "--deferred" && has_value)
+		{
+			args.deferred_threads = std::max(0, atoi(argv[++i]));
+		}
+		else if (arg == "--reuse-lines")
+		{
+			args.reuse_lines = true;
+		}
+		else if (arg == "--update")
+		{
+			args.update = true;
+		}
+		else if (arg.rfind("--", 0) == 0)
+		{
+			return false;
+		}
+		else
+		{
+			args.dumps.push_back(arg);
+		}
+	}
+
+	return !args.dumps.empty();
+}
+
+//Draws every visible line of a frame the way the VDP queues them, but without running the rest of the system
+static void draw_frame(bool reuse_lines)
+{
+	if (!reuse_lines)
+	{
+		Video::Renderer::invalidate_lines();
+	}
+
+	Video::start_frame();
+	int lines = Video::get_display_scanlines();
+	for (int y = 0; y < lines; y++)
+	{
+		Video::Renderer::queue_scanline(y, 0, DISPLAY_WIDTH);
+	}
+	Video::Renderer::finish_frame();
+}
+
+//FNV-1a over the visible part of the display output
+static uint64_t hash_frame()
+{
+	const uint8_t* data = (const uint8_t*)Video::get_display_output();
+	size_t size = Video::get_display_scanlines() * DISPLAY_WIDTH * sizeof(uint16_t);
+
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ data[i]) * 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+static fs::path golden_path(const fs::path& dump, const char* extension)
+{
+	fs::path path = dump;
+	path += extension;
+	return path;
+}
+
+//Returns whether the dump loaded and matched its golden hash, or had its golden files written
+static bool run_dump(const Args& args, const fs::path& dump)
+{
+	std::vector<uint8_t> bios(Memory::BIOS_SIZE);
+	Memory::initialize(bios);
+	Timing::initialize();
+	Video::initialize();
+
+	bool passed = Video::load_serial_dump(dump);
+	if (passed)
+	{
+		//The first frame isn't timed, so every dump starts with its caches warm
+		draw_frame(false);
+
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < args.frames; i++)
+		{
+			draw_frame(args.reuse_lines);
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		int lines = args.frames * Video::get_display_scanlines();
+		uint64_t hash = hash_frame();
+		printf("%s: %d lines in %.3fs, %.0f lines/s, hash %016" PRIx64, dump.string().c_str(), lines, elapsed.count(),
+			   lines / elapsed.count(), hash);
+
+		if (args.update)
+		{
+			std::ofstream(golden_path(dump, ".golden")) << std::hex << hash << "\n";
+			Video::dump_current_frame(imagew::IMAGE_TYPE_BMP, golden_path(dump, ".golden.bmp"));
+			printf(" (updated)\n");
+		}
+		else
+		{
+			uint64_t golden = 0;
+			std::ifstream golden_file(golden_path(dump, ".golden"));
+			if (!(golden_file >> std::hex >> golden))
+			{
+				printf(" (no golden hash)\n");
+				passed = false;
+			}
+			else if (golden != hash)
+			{
+				printf(" MISMATCH, expected %016" PRIx64 "\n", golden);
+				Video::dump_current_frame(imagew::IMAGE_TYPE_BMP, golden_path(dump, ".actual.bmp"));
+				passed = false;
+			}
+			else
+			{
+				printf(" OK\n");
+			}
+		}
+	}
+
+	Video::shutdown();
+	Timing::shutdown();
+	Memory::shutdown();
+	return passed;
+}
+
+int main(int argc, char** argv)
+{
+	Args args;
+	if (!parse_args(argc, argv, args))
+	{
+		print_usage();
+		return 2;
+	}
+
+	Log::set_level(Log::WARN);
+	Video::set_threaded_render(args.threaded);
+	Video::set_deferred_render(args.deferred_threads);
+	printf("Renderer: %s%s\n", Video::Renderer::SIMD::get_impl_name(),
+		   args.deferred_threads ? ", deferred" : (args.threaded ? ", threaded" : ""));
+
+	int failed = 0;
+	for (const fs::path& dump : args.dumps)
+	{
+		failed += !run_dump(args, dump);
+	}
+
+	if (failed)
+	{
+		printf("%d of %d dumps failed\n", failed, (int)args.dumps.size());
+	}
+	return failed ? 1 : 0;
+}
@@ -6,11 +6,46 @@
 #include <cassert>
 #include <cstring>
 
+#include "video/render_simd.h"
 #include "video/vdp_local.h"
 
 namespace Video::Renderer
 {
 
+constexpr static int MASK_WORDS = DISPLAY_WIDTH / 64;
+
+//Working state for drawing one line. Every line gets its own, so lines can be drawn on any thread.
+struct LineContext
+{
+	const RenderRegs& regs;
+
+	//Palette indices of each screen, where Screen A is 0 and Screen B is 1
+	//Layers are drawn from the highest priority down, so a pixel is only written while it's still 0 (transparent)
+	uint8_t screens[2][DISPLAY_WIDTH];
+
+	//Which pixels of each screen a layer has already drawn, one bit per pixel
+	uint64_t opaque[2][MASK_WORDS];
+
+	//The pixels being drawn, which is less than the whole line for a segment between mid-line register writes
+	int start_x;
+	int end_x;
+
+	//Both screens start out transparent, showing their backdrop color
+	//Pixels outside the span count as already drawn, so the layers skip them and stop once the span is covered
+	explicit LineContext(const RenderRegs& regs, int start_x = 0, int end_x = DISPLAY_WIDTH)
+		: regs(regs), screens(), opaque(), start_x(start_x), end_x(end_x)
+	{
+		for (int x = 0; x < DISPLAY_WIDTH; x++)
+		{
+			if (x < start_x || x >= end_x)
+			{
+				opaque[0][x >> 6] |= 1ULL << (x & 0x3F);
+				opaque[1][x >> 6] |= 1ULL << (x & 0x3F);
+			}
+		}
+	}
+};
+
 struct TilemapInfo
 {
 	int width;
@@ -19,35 +54,94 @@ struct TilemapInfo
 	uint32_t data_start;
 };
 
-static uint16_t read_palette(uint8_t value)
+static inline uint16_t read_palette(uint8_t value)
 {
-	uint16_t color;
-	memcpy(&color, vdp.palette + (value * 2), 2);
-	return Common::bswp16(color);
+	return vdp.palette_colors[value];
 }
 
-static uint16_t read_screen(int index, int x)
+static bool uses_backdrop_only(LineContext& ctx, int index)
 {
-	uint8_t pal_color = vdp.screens[index][x];
-	if (!pal_color || (index == 1 && vdp.color_prio.screen_b_backdrop_only))
+	return index == 1 && ctx.regs.color_prio.screen_b_backdrop_only;
+}
+
+static uint16_t read_screen(LineContext& ctx, int index, int x)
+{
+	uint8_t pal_color = ctx.screens[index][x];
+	if (!pal_color || uses_backdrop_only(ctx, index))
 	{
-		return vdp.backdrops[index];
+		return ctx.regs.backdrops[index];
 	}
 
 	return read_palette(pal_color);
 }
 
-static void write_screen(int index, int x, uint8_t value)
+//Draws a pixel unless a higher priority layer already has
+static void write_screen(LineContext& ctx, int index, int x, uint8_t value)
 {
 	x &= 0x1FF;
-	if (x < DISPLAY_WIDTH)
+	if (x < DISPLAY_WIDTH && !ctx.screens[index][x])
+	{
+		ctx.screens[index][x] = value;
+		ctx.opaque[index][x >> 6] |= 1ULL << (x & 0x3F);
+	}
+}
+
+//Draws a layer's line of palette indices under what's on the screen, a word of mask bits at a time
+static void write_screen_row(LineContext& ctx, int index, const uint8_t* row, const uint64_t* row_mask)
+{
+	for (int word = 0; word < MASK_WORDS; word++)
+	{
+		uint64_t visible = row_mask[word] & ~ctx.opaque[index][word];
+		if (!visible)
+		{
+			continue;
+		}
+
+		uint8_t* output = &ctx.screens[index][word * 64];
+		if (!ctx.opaque[index][word])
+		{
+			memcpy(output, &row[word * 64], 64);
+		}
+		else
+		{
+			SIMD::blit_under(&row[word * 64], output, 64);
+		}
+		ctx.opaque[index][word] |= row_mask[word];
+	}
+}
+
+static bool is_screen_full(LineContext& ctx, int index)
+{
+	uint64_t full = ~0ULL;
+	for (int word = 0; word < MASK_WORDS; word++)
+	{
+		full &= ctx.opaque[index][word];
+	}
+	return full == ~0ULL;
+}
+
+//Whether a layer drawing to the screens in output_mode (bit 0 for B, bit 1 for A) would be entirely covered
+//Layer capture keeps every layer, so nothing is hidden while it's on
+static bool is_layer_hidden(LineContext& ctx, int output_mode)
+{
+	if (vdp.bg_output[0])
 	{
-		vdp.screens[index][x] = value;
+		return false;
 	}
+
+	bool hidden_b = !(output_mode & 0x1) || is_screen_full(ctx, 1);
+	bool hidden_a = !(output_mode & 0x2) || is_screen_full(ctx, 0);
+	return hidden_a && hidden_b;
 }
 
 static inline void write_color_raw(std::unique_ptr<uint16_t[]>& buffer, int x, int y, uint16_t value)
 {
+	//Layer buffers are only allocated when layer capture is on
+	if (!buffer)
+	{
+		return;
+	}
+
 	x &= 0x1FF;
 	if (x < DISPLAY_WIDTH)
 	{
@@ -62,13 +156,39 @@ static inline void write_color(std::unique_ptr<uint16_t[]>& buffer, int x, int y
 
 static void write_pal_color(std::unique_ptr<uint16_t[]>& buffer, int x, int y, uint8_t pal_index)
 {
+	if (!buffer)
+	{
+		return;
+	}
+
 	uint16_t color = read_palette(pal_index);
 	write_color(buffer, x, y, color);
 }
 
-static int get_bg_tile_size(int index)
+static uint8_t* get_4bpp_tile(uint32_t addr)
 {
-	int tile_size = (index == 0) ? vdp.bg_ctrl.tile_size0 : vdp.bg_ctrl.tile_size1;
+	int slot = (addr & (TILE_VRAM_SIZE - 1)) >> 5;
+	uint8_t* pixels = vdp.tile_cache[slot];
+
+	uint64_t valid_bit = 1ULL << (slot & 0x3F);
+	if (!(vdp.tile_cache_valid[slot >> 6] & valid_bit))
+	{
+		//Expand each byte to two pixels, with the high nibble on the left
+		uint8_t* data = &vdp.tile[slot << 5];
+		for (int i = 0; i < 32; i++)
+		{
+			pixels[i * 2] = data[i] >> 4;
+			pixels[i * 2 + 1] = data[i] & 0xF;
+		}
+		vdp.tile_cache_valid[slot >> 6] |= valid_bit;
+	}
+
+	return pixels;
+}
+
+static int get_bg_tile_size(const RenderRegs& regs, int index)
+{
+	int tile_size = (index == 0) ? regs.bg_ctrl.tile_size0 : regs.bg_ctrl.tile_size1;
 	switch (tile_size)
 	{
 	case 0x00:
@@ -89,9 +209,9 @@ static int get_bg_tile_size(int index)
 	return tile_size;
 }
 
-static void get_tilemap_info(TilemapInfo& info)
+static void get_tilemap_info(const RenderRegs& regs, TilemapInfo& info)
 {
-	switch (vdp.bg_ctrl.map_size)
+	switch (regs.bg_ctrl.map_size)
 	{
 	case 0x00:
 		info.width = 64;
@@ -114,7 +234,7 @@ static void get_tilemap_info(TilemapInfo& info)
 	}
 
 	info.data_start = (info.width * info.height) << 1;
-	if (vdp.bg_ctrl.shared_maps)
+	if (regs.bg_ctrl.shared_maps)
 	{
 		info.bg1_start = 0;
 	}
@@ -125,28 +245,30 @@ static void get_tilemap_info(TilemapInfo& info)
 	}
 }
 
-static void draw_bg(int index, int screen_y)
+template <bool IS_8BIT> static void draw_bg_mode(LineContext& ctx, int index, int screen_y)
 {
-	if (!vdp.layer_ctrl.bg_enable[index])
-	{
-		return;
-	}
-
-	bool is_8bit = index == 0 && vdp.bg_ctrl.bg0_8bit;
-	int tile_size = get_bg_tile_size(index);
+	int tile_size = get_bg_tile_size(ctx.regs, index);
 	int tile_size_mask = tile_size - 1;
 
 	TilemapInfo tilemap;
-	get_tilemap_info(tilemap);
+	get_tilemap_info(ctx.regs, tilemap);
 
 	uint32_t map_start = (index == 1) ? tilemap.bg1_start : 0;
 
-	for (int screen_x = 0; screen_x < DISPLAY_WIDTH; screen_x++)
-	{
-		int x = (screen_x + vdp.bg_scrollx[index]) & ((tilemap.width * tile_size) - 1);
-		int y = (screen_y + vdp.bg_scrolly[index]) & ((tilemap.height * tile_size) - 1);
+	int scrollx = ctx.regs.bg_scrollx[index];
+	int width_mask = (tilemap.width * tile_size) - 1;
+	int y = (screen_y + ctx.regs.bg_scrolly[index]) & ((tilemap.height * tile_size) - 1);
+	int map_row = (y / tile_size) * tilemap.width;
+
+	//Each tile can go to either screen, so the layer is drawn to a row for each and then put under what's there
+	uint8_t layer_rows[2][DISPLAY_WIDTH] = {};
 
-		uint16_t map_offs = (x / tile_size) + ((y / tile_size) * tilemap.width);
+	//Pixels are drawn in spans: the descriptor is resolved once per tile, and each 8x8 row within it is fetched once
+	int screen_x = ctx.start_x;
+	while (screen_x < ctx.end_x)
+	{
+		int x = (screen_x + scrollx) & width_mask;
+		uint16_t map_offs = (x / tile_size) + map_row;
 
 		uint16_t descriptor;
 		memcpy(&descriptor, &vdp.tile[map_start + (map_offs << 1)], 2);
@@ -158,70 +280,106 @@ static void draw_bg(int index, int screen_y)
 		bool x_flip = (descriptor >> 14) & 0x1;
 		bool y_flip = descriptor >> 15;
 
-		int tile_x = x & tile_size_mask;
-		if (x_flip)
-		{
-			tile_x = tile_size_mask - tile_x;
-		}
-
 		int tile_y = y & tile_size_mask;
 		if (y_flip)
 		{
 			tile_y = tile_size_mask - tile_y;
 		}
 
-		tile_index += tile_y & ~0x7;
-		tile_index += tile_x >> 3;
-		uint32_t offs = (tile_x & 0x7) + ((tile_y & 0x7) * 0x08) + (tile_index << 6);
-
-		uint8_t tile_data;
-		if (is_8bit)
+		uint8_t pal_bits = 0;
+		if constexpr (!IS_8BIT)
 		{
-			tile_data = vdp.tile[(tilemap.data_start + offs) & 0xFFFF];
+			uint16_t palsel = ctx.regs.bg_palsel[index];
+			pal_bits = ((palsel >> (pal_descriptor * 4)) & 0xF) << 4;
 		}
-		else
+
+		int tile_end = std::min(ctx.end_x, screen_x + tile_size - (x & tile_size_mask));
+		while (screen_x < tile_end)
 		{
-			offs >>= 1;
-			offs += vdp.tilebase << 9;
-			tile_data = vdp.tile[(tilemap.data_start + offs) & 0xFFFF];
-			if (tile_x & 0x1)
+			x = (screen_x + scrollx) & width_mask;
+			int tile_x = x & tile_size_mask;
+			if (x_flip)
 			{
-				tile_data &= 0xF;
+				tile_x = tile_size_mask - tile_x;
+			}
+
+			uint16_t row_index = tile_index;
+			row_index += tile_y & ~0x7;
+			row_index += tile_x >> 3;
+			uint32_t row_offs = (tile_y & 0x7) * 0x08;
+
+			const uint8_t* row = nullptr;
+			uint32_t row_addr = 0;
+			if constexpr (IS_8BIT)
+			{
+				row_addr = tilemap.data_start + row_offs + (row_index << 6);
 			}
 			else
 			{
-				tile_data >>= 4;
+				uint32_t tile_addr = tilemap.data_start + (ctx.regs.tilebase << 9) + (row_index << 5);
+				row = get_4bpp_tile(tile_addr) + row_offs;
 			}
-		}
 
-		//0 is transparent, no matter if it's 4-bit or 8-bit
-		if (!tile_data)
-		{
-			write_color_raw(vdp.bg_output[index], screen_x, screen_y, 0);
-			continue;
-		}
+			int flip_mask = x_flip ? 0x7 : 0;
+			int span_end = std::min(tile_end, screen_x + 8 - (x & 0x7));
+			for (; screen_x < span_end; screen_x++)
+			{
+				int pixel = ((screen_x + scrollx) & 0x7) ^ flip_mask;
+				uint8_t tile_data = IS_8BIT ? vdp.tile[(row_addr + pixel) & 0xFFFF] : row[pixel];
 
-		uint8_t output = tile_data;
-		if (!is_8bit)
-		{
-			uint16_t palsel = vdp.bg_palsel[index];
-			int pal = (palsel >> (pal_descriptor * 4)) & 0xF;
-			output |= pal << 4;
+				//0 is transparent, no matter if it's 4-bit or 8-bit
+				if (!tile_data)
+				{
+					write_color_raw(vdp.bg_output[index], screen_x, screen_y, 0);
+					continue;
+				}
+
+				uint8_t output = tile_data | pal_bits;
+				write_pal_color(vdp.bg_output[index], screen_x, screen_y, output);
+				layer_rows[screen_index][screen_x] = output;
+			}
 		}
+	}
 
-		write_pal_color(vdp.bg_output[index], screen_x, screen_y, output);
-		write_screen(screen_index, screen_x, output);
+	for (int i = 0; i < 2; i++)
+	{
+		uint64_t layer_mask[MASK_WORDS];
+		SIMD::opaque_mask(layer_rows[i], layer_mask);
+		write_screen_row(ctx, i, layer_rows[i], layer_mask);
 	}
 }
 
-static void draw_bitmap(int index, int y)
+static void draw_bg(LineContext& ctx, int index, int screen_y)
 {
-	if (!vdp.layer_ctrl.bitmap_enable[index])
+	//Each tile picks its own screen
+	if (!ctx.regs.layer_ctrl.bg_enable[index] || is_layer_hidden(ctx, 0x3))
 	{
 		return;
 	}
 
-	VDP::BitmapRegs* regs = &vdp.bitmap_regs[index];
+	if (index == 0 && ctx.regs.bg_ctrl.bg0_8bit)
+	{
+		draw_bg_mode<true>(ctx, index, screen_y);
+	}
+	else
+	{
+		draw_bg_mode<false>(ctx, index, screen_y);
+	}
+}
+
+//Layout of bitmap VRAM for each BITMAP_CTRL mode
+template <int MODE> struct BitmapLayout
+{
+	static constexpr bool is_8bit = MODE == 0x00 || MODE == 0x01;
+	static constexpr bool split_x = MODE == 0x03;
+	static constexpr bool split_y = MODE == 0x00 || MODE == 0x02;
+	static constexpr int vram_width = (MODE == 0x02 || MODE == 0x04) ? 512 : 256;
+	static constexpr int vram_height = (MODE == 0x00 || MODE == 0x02) ? 256 : 512;
+};
+
+template <int MODE> static void draw_bitmap_mode(LineContext& ctx, int index, int y)
+{
+	const RenderRegs::BitmapRegs* regs = &ctx.regs.bitmap_regs[index];
 
 	//Skip drawing if the bitmap is off-screen verticaly
 	if (((y - regs->screeny) & 0x1FF) > regs->h)
@@ -243,48 +401,21 @@ static void draw_bitmap(int index, int y)
 		return;
 	}
 
-	bool is_8bit = false;
-	bool split_x = false, split_y = false;
-	int vram_width = 0, vram_height = 0;
-	switch (vdp.bitmap_ctrl)
-	{
-	case 0x00:
-		is_8bit = true;
-		split_y = true;
-		vram_width = 256;
-		vram_height = 256;
-		break;
-	case 0x01:
-		is_8bit = true;
-		vram_width = 256;
-		vram_height = 512;
-		break;
-	case 0x02:
-		split_y = true;
-		vram_width = 512;
-		vram_height = 256;
-		break;
-	case 0x03:
-		split_x = true;
-		vram_width = 256;
-		vram_height = 512;
-		break;
-	case 0x04:
-		vram_width = 512;
-		vram_height = 512;
-		break;
-	default:
-		assert(0);
-	}
-	uint8_t subpalette_bits = ((vdp.bitmap_palsel >> ((3 - index) * 4)) & 0xF) << 4;
+	constexpr bool is_8bit = BitmapLayout<MODE>::is_8bit;
+	constexpr bool split_x = BitmapLayout<MODE>::split_x;
+	constexpr bool split_y = BitmapLayout<MODE>::split_y;
+	constexpr int vram_width = BitmapLayout<MODE>::vram_width;
+	constexpr int vram_height = BitmapLayout<MODE>::vram_height;
+
+	uint8_t subpalette_bits = ((ctx.regs.bitmap_palsel >> ((3 - index) * 4)) & 0xF) << 4;
 	bool use_color_buffer = (regs->buffer_ctrl & 0x100) != 0;
 
-	int width_mask = vram_width - 1;
-	int height_mask = vram_height - 1;
+	constexpr int width_mask = vram_width - 1;
+	constexpr int height_mask = vram_height - 1;
 
 	int data_y = (y + regs->scrolly - regs->screeny) & height_mask;
 	//If split_y is true, there are two separate maps at y=0 and y=256 that get scrolled independently
-	if (split_y)
+	if constexpr (split_y)
 	{
 		data_y |= regs->scrolly & 0x100;
 	}
@@ -293,114 +424,278 @@ static void draw_bitmap(int index, int y)
 	//TODO: this fetching should take place on the previous scanline (should subpalette mapping happen earlier too?)
 	uint8_t bm_cache_line[256];
 	int bm_cache_end = std::min(255, regs->w + 1); //HW bug: one extra pixel is processed unless full line
-	for (int x = 0; x <= bm_cache_end; x++)
+	if (!use_color_buffer)
 	{
-		int data_x = (x + regs->scrollx) & width_mask;
-		if (split_x)
+		//Without color buffering every pixel is independent, so each contiguous run of VRAM is fetched at once
+		int x = 0;
+		while (x <= bm_cache_end)
 		{
-			data_x |= regs->scrollx & 0x100;
-		}
+			int wrapped_x = (x + regs->scrollx) & width_mask;
+			int run = std::min(bm_cache_end + 1 - x, vram_width - wrapped_x);
 
-		uint32_t addr;
-		uint8_t data;
-		if (is_8bit)
-		{
-			addr = data_x + (data_y * 256);
-			data = vdp.bitmap[addr & 0x1FFFF];
-		}
-		else
-		{
-			addr = (data_x >> 1) + (data_y * 256);
-			data = vdp.bitmap[addr & 0x1FFFF];
-			if (data_x & 0x1)
+			int data_x = wrapped_x;
+			if constexpr (split_x)
 			{
-				data &= 0xF;
+				data_x |= regs->scrollx & 0x100;
 			}
-			else
+
+			uint8_t* output = &bm_cache_line[x];
+			if constexpr (is_8bit)
 			{
-				data >>= 4;
+				memcpy(output, &vdp.bitmap[data_x + (data_y * 256)], run);
 			}
-
-			if (data > 0)
+			else
 			{
-				if (data == 0xF && use_color_buffer)
+				const uint8_t* data = &vdp.bitmap[(data_x >> 1) + (data_y * 256)];
+				int i = 0;
+				if (data_x & 0x1)
 				{
-					data = 0xFF;
+					uint8_t pixel = *data++ & 0xF;
+					output[i++] = pixel ? (pixel | subpalette_bits) : 0;
 				}
-				else
+
+				int bytes = (run - i) >> 1;
+				SIMD::expand_4bpp(data, &output[i], bytes, subpalette_bits);
+				i += bytes * 2;
+
+				if (i < run)
 				{
-					data |= subpalette_bits;
+					uint8_t pixel = data[bytes] >> 4;
+					output[i] = pixel ? (pixel | subpalette_bits) : 0;
 				}
 			}
-		}
 
-		if (use_color_buffer)
+			x += run;
+		}
+	}
+	else
+	{
+		for (int x = 0; x <= bm_cache_end; x++)
 		{
-			uint8_t threshold_mask = is_8bit ? 0xFF : 0x0F;
-			if (data == 0xFF)
+			int data_x = (x + regs->scrollx) & width_mask;
+			if constexpr (split_x)
 			{
-				//HW bug: 0xFF fails to get replaced if x=0xFF
-				if (x != 0xFF)
+				data_x |= regs->scrollx & 0x100;
+			}
+
+			uint32_t addr;
+			uint8_t data;
+			if constexpr (is_8bit)
+			{
+				addr = data_x + (data_y * 256);
+				data = vdp.bitmap[addr & 0x1FFFF];
+			}
+			else
+			{
+				addr = (data_x >> 1) + (data_y * 256);
+				data = vdp.bitmap[addr & 0x1FFFF];
+				if (data_x & 0x1)
 				{
-					data = regs->buffered_color;
+					data &= 0xF;
+				}
+				else
+				{
+					data >>= 4;
+				}
+
+				if (data > 0)
+				{
+					if (data == 0xF && use_color_buffer)
+					{
+						data = 0xFF;
+					}
+					else
+					{
+						data |= subpalette_bits;
+					}
 				}
 			}
-			else if ((data & threshold_mask) < (regs->buffer_ctrl & threshold_mask))
+
+			if (use_color_buffer)
 			{
-				regs->buffered_color = data;
+				uint8_t threshold_mask = is_8bit ? 0xFF : 0x0F;
+				if (data == 0xFF)
+				{
+					//HW bug: 0xFF fails to get replaced if x=0xFF
+					if (x != 0xFF)
+					{
+						data = vdp.bitmap_buffered_color[index];
+					}
+				}
+				else if ((data & threshold_mask) < (regs->buffer_ctrl & threshold_mask))
+				{
+					vdp.bitmap_buffered_color[index] = data;
+				}
 			}
-		}
 
-		//Now that the buffer control logic has been processed, store the pixel to the cache line
-		bm_cache_line[x] = data;
+			//Now that the buffer control logic has been processed, store the pixel to the cache line
+			bm_cache_line[x] = data;
+		}
 	}
 
 	//Now draw the appropriate part of the cache line to the screen according to screenx
 	//For 4bit, subpalette lookups happen in this phase
-	for(int x = visible_left; x <= visible_right; x++)
+	//The whole cache line is always fetched for the color buffer latch, but only the span being drawn is laid out
+	visible_left = std::max(visible_left, ctx.start_x);
+	visible_right = std::min(visible_right, ctx.end_x - 1);
+	int pair_index = index >> 1;
+	int output_mode = ctx.regs.layer_ctrl.bitmap_screen_mode[pair_index];
+
+	if (vdp.bitmap_output[index])
 	{
-		uint8_t data = bm_cache_line[(x - screenx) & 0xFF];
-		if (data == 0)
+		for (int x = visible_left; x <= visible_right; x++)
 		{
-			continue;
+			uint8_t data = bm_cache_line[(x - screenx) & 0xFF];
+			if (data)
+			{
+				write_pal_color(vdp.bitmap_output[index], x, y, data);
+			}
 		}
+	}
 
-		uint8_t output = data;
+	//Lay the visible part of the cache line out on the screen, splitting where the cache line index wraps around
+	uint8_t layer_row[DISPLAY_WIDTH] = {};
+	int x = visible_left;
+	while (x <= visible_right)
+	{
+		int line_x = (x - screenx) & 0xFF;
+		int run = std::min(visible_right + 1 - x, 256 - line_x);
+		memcpy(&layer_row[x], &bm_cache_line[line_x], run);
+		x += run;
+	}
 
-		int pair_index = index >> 1;
-		int output_mode = vdp.layer_ctrl.bitmap_screen_mode[pair_index];
+	uint64_t layer_mask[MASK_WORDS];
+	SIMD::opaque_mask(layer_row, layer_mask);
 
-		write_pal_color(vdp.bitmap_output[index], x, y, output);
+	if (output_mode & 0x1)
+	{
+		write_screen_row(ctx, 1, layer_row, layer_mask);
+	}
 
-		if (output_mode & 0x1)
-		{
-			write_screen(1, x, output);
-		}
+	if (output_mode & 0x2)
+	{
+		write_screen_row(ctx, 0, layer_row, layer_mask);
+	}
+}
 
-		if (output_mode & 0x2)
+static void draw_bitmap(LineContext& ctx, int index, int y)
+{
+	if (!ctx.regs.layer_ctrl.bitmap_enable[index])
+	{
+		return;
+	}
+
+	//Layers with color buffering are drawn even when hidden, as the latch carries over to the next line
+	int output_mode = ctx.regs.layer_ctrl.bitmap_screen_mode[index >> 1];
+	if (!uses_color_buffer(ctx.regs, index) && is_layer_hidden(ctx, output_mode))
+	{
+		return;
+	}
+
+	switch (ctx.regs.bitmap_ctrl)
+	{
+	case 0x00:
+		draw_bitmap_mode<0x00>(ctx, index, y);
+		break;
+	case 0x01:
+		draw_bitmap_mode<0x01>(ctx, index, y);
+		break;
+	case 0x02:
+		draw_bitmap_mode<0x02>(ctx, index, y);
+		break;
+	case 0x03:
+		draw_bitmap_mode<0x03>(ctx, index, y);
+		break;
+	case 0x04:
+		draw_bitmap_mode<0x04>(ctx, index, y);
+		break;
+	default:
+		assert(0);
+	}
+}
+
+static int get_obj_height(uint32_t descriptor)
+{
+	constexpr static int OBJ_HEIGHTS[4] = {8, 16, 32, 32};
+	return OBJ_HEIGHTS[(descriptor >> 10) & 0x3];
+}
+
+static void set_obj_lines(int id, bool visible)
+{
+	uint64_t bit = 1ULL << (id & 0x3F);
+	for (int i = 0; i < vdp.obj_line_count[id]; i++)
+	{
+		int line = (vdp.obj_line_start[id] + i) & 0x1FF;
+		if (line < DISPLAY_HEIGHT)
 		{
-			write_screen(0, x, output);
+			if (visible)
+			{
+				vdp.obj_line_mask[line][id >> 6] |= bit;
+			}
+			else
+			{
+				vdp.obj_line_mask[line][id >> 6] &= ~bit;
+			}
 		}
 	}
 }
 
-static void draw_obj(int index, int screen_y)
+static void update_obj_lines()
 {
-	if (!vdp.layer_ctrl.obj_enable[index])
+	for (int word = 0; word < 2; word++)
 	{
-		return;
+		while (vdp.obj_dirty[word])
+		{
+			int bit = __builtin_ctzll(vdp.obj_dirty[word]);
+			vdp.obj_dirty[word] &= vdp.obj_dirty[word] - 1;
+			int id = (word << 6) | bit;
+
+			uint32_t descriptor;
+			memcpy(&descriptor, vdp.oam + (id * 4), 4);
+			descriptor = Common::bswp32(descriptor);
+
+			//Remove the OBJ from the lines it used to cover, then add it to the new ones
+			set_obj_lines(id, false);
+
+			int start_y = (descriptor >> 16) & 0xFF;
+			bool high_y = (descriptor >> 9) & 0x1;
+			vdp.obj_line_start[id] = start_y | (high_y << 8);
+			vdp.obj_line_count[id] = get_obj_height(descriptor);
+
+			set_obj_lines(id, true);
+		}
 	}
+}
 
+template <bool IS_8BIT> static void draw_obj_mode(LineContext& ctx, int index, int screen_y)
+{
 	//TODO: limit the maximum number of sprites per scanline
 
 	//Tilemap info is only useful here to get the start of tile data
 	TilemapInfo tilemap;
-	get_tilemap_info(tilemap);
+	get_tilemap_info(ctx.regs, tilemap);
 
-	//OBJ #0 has highest priority, so the loop must be backwards
-	for (int id = OBJ_COUNT - 1; id >= 0; id--)
+	//Only visit the OBJs on this line. OBJ #0 has highest priority, so it's drawn first and the rest go under it.
+	int line_ids[OBJ_COUNT];
+	int line_id_count = 0;
+	for (int word = 0; word < 2; word++)
 	{
-		int test_id = (id - vdp.obj_ctrl.id_offs) & 0xFF;
+		uint64_t mask = vdp.obj_line_mask[screen_y][word];
+		while (mask)
+		{
+			int bit = __builtin_ctzll(mask);
+			mask &= mask - 1;
+			line_ids[line_id_count++] = (word << 6) | bit;
+		}
+	}
+
+	//Pixels of the layer capture output that a higher priority OBJ already drew
+	uint64_t layer_drawn[MASK_WORDS] = {};
+
+	for (int i = 0; i < line_id_count; i++)
+	{
+		int id = line_ids[i];
+		int test_id = (id - ctx.regs.obj_ctrl.id_offs) & 0xFF;
 		if (index == 0 && test_id >= OBJ_COUNT)
 		{
 			continue;
@@ -440,76 +735,60 @@ static void draw_obj(int index, int screen_y)
 			assert(0);
 		}
 
-		int start_y = (descriptor >> 16) & 0xFF;
-		bool high_y = (descriptor >> 9) & 0x1;
+		//The line mask already guarantees the OBJ intersects this line
+		int start_y = vdp.obj_line_start[id];
 
-		start_y |= high_y << 8;
+		int start_x = descriptor & 0x1FF;
 
-		int end_y = (start_y + obj_height) & 0x1FF;
+		bool x_flip = (descriptor >> 14) & 0x1;
+		bool y_flip = (descriptor >> 15) & 0x1;
 
-		if (end_y > start_y)
+		int tile_y = (screen_y - start_y) & (obj_height - 1);
+		if (y_flip)
 		{
-			if (screen_y < start_y || screen_y >= end_y)
-			{
-				continue;
-			}
+			tile_y = obj_height - 1 - tile_y;
 		}
-		else
+
+		uint8_t pal_bits = 0;
+		if constexpr (!IS_8BIT)
 		{
-			if (screen_y < start_y && screen_y >= end_y)
-			{
-				continue;
-			}
+			uint16_t palsel = ctx.regs.obj_palsel[index];
+			int pal_descriptor = (descriptor >> 12) & 0x3;
+			pal_bits = ((palsel >> (pal_descriptor * 4)) & 0xF) << 4;
 		}
 
-		int start_x = descriptor & 0x1FF;
+		int output_mode = ctx.regs.layer_ctrl.obj_screen_mode[index];
 
 		for (int screen_x = start_x; screen_x < start_x + obj_width; screen_x++)
 		{
-			if ((screen_x & 0x1FF) >= DISPLAY_WIDTH)
+			int wrapped_x = screen_x & 0x1FF;
+			if (wrapped_x < ctx.start_x || wrapped_x >= ctx.end_x)
 			{
 				continue;
 			}
 
-			bool x_flip = (descriptor >> 14) & 0x1;
-			bool y_flip = (descriptor >> 15) & 0x1;
-
 			int tile_x = (screen_x - start_x) & (obj_width - 1);
 			if (x_flip)
 			{
 				tile_x = obj_width - 1 - tile_x;
 			}
 
-			int tile_y = (screen_y - start_y) & (obj_height - 1);
-			if (y_flip)
-			{
-				tile_y = obj_height - 1 - tile_y;
-			}
-
 			int tile_index = descriptor >> 24;
 			tile_index += tile_y & ~0x7;
 			tile_index += tile_x >> 3;
-			tile_index += vdp.obj_ctrl.tile_index_offs[index] << 8;
-			uint32_t offs = (tile_x & 0x7) + ((tile_y & 0x7) * 0x08) + (tile_index << 6);
+			tile_index += ctx.regs.obj_ctrl.tile_index_offs[index] << 8;
+			uint32_t pixel_offs = (tile_x & 0x7) + ((tile_y & 0x7) * 0x08);
 
 			uint8_t tile_data;
-			if (vdp.obj_ctrl.is_8bit)
+			if constexpr (IS_8BIT)
 			{
+				uint32_t offs = pixel_offs + (tile_index << 6);
 				tile_data = vdp.tile[(tilemap.data_start + offs) & 0xFFFF];
 			}
 			else
 			{
-				offs >>= 1;
-				offs += vdp.tilebase << 9;
-				tile_data = vdp.tile[(tilemap.data_start + offs) & 0xFFFF];
-				if (tile_x & 0x1)
-				{
-					tile_data &= 0xF;
-				}
-				else
-				{
-					tile_data >>= 4;
-				}
+				uint32_t tile_addr = tilemap.data_start + (ctx.regs.tilebase << 9) + (tile_index << 5);
+				tile_data = get_4bpp_tile(tile_addr)[pixel_offs];
 			}
 
 			if (!tile_data)
@@ -517,242 +796,360 @@ static void draw_obj(int index, int screen_y)
 				continue;
 			}
 
-			uint8_t output = tile_data;
-			if (!vdp.obj_ctrl.is_8bit)
+			uint8_t output = tile_data | pal_bits;
+
+			if (vdp.obj_output[index])
 			{
-				uint16_t palsel = vdp.obj_palsel[index];
-				int pal_descriptor = (descriptor >> 12) & 0x3;
-				int pal = (palsel >> (pal_descriptor * 4)) & 0xF;
-				output |= pal << 4;
+				uint64_t drawn_bit = 1ULL << (wrapped_x & 0x3F);
+				if (!(layer_drawn[wrapped_x >> 6] & drawn_bit))
+				{
+					layer_drawn[wrapped_x >> 6] |= drawn_bit;
+					write_pal_color(vdp.obj_output[index], screen_x, screen_y, output);
+				}
 			}
 
-			write_pal_color(vdp.obj_output[index], screen_x, screen_y, output);
-			int output_mode = vdp.layer_ctrl.obj_screen_mode[index];
 			if (output_mode & 0x1)
 			{
-				write_screen(1, screen_x, output);
+				write_screen(ctx, 1, screen_x, output);
 			}
 
 			if (output_mode & 0x2)
 			{
-				write_screen(0, screen_x, output);
+				write_screen(ctx, 0, screen_x, output);
 			}
 		}
 	}
 }
 
-static void draw_layers(int y)
+static void draw_obj(LineContext& ctx, int index, int screen_y)
+{
+	if (!ctx.regs.layer_ctrl.obj_enable[index] || is_layer_hidden(ctx, ctx.regs.layer_ctrl.obj_screen_mode[index]))
+	{
+		return;
+	}
+
+	if (ctx.regs.obj_ctrl.is_8bit)
+	{
+		draw_obj_mode<true>(ctx, index, screen_y);
+	}
+	else
+	{
+		draw_obj_mode<false>(ctx, index, screen_y);
+	}
+}
+
+static void draw_layers(LineContext& ctx, int y)
 {
 	//Draw each layer
-	//The order is important - each layer has a different priority, and lower priority layers are drawn first here
-	int bitmap_prio = vdp.color_prio.prio_mode & 0x1;
-	int bg0_prio = (vdp.color_prio.prio_mode >> 1) & 0x1;
-	int obj0_prio = vdp.color_prio.prio_mode >> 2;
+	//The order is important - each layer has a different priority, and higher priority layers are drawn first here,
+	//so lower priority ones only fill in what's still transparent and can be skipped once the screens are covered
+	int bitmap_prio = ctx.regs.color_prio.prio_mode & 0x1;
+	int bg0_prio = (ctx.regs.color_prio.prio_mode >> 1) & 0x1;
+	int obj0_prio = ctx.regs.color_prio.prio_mode >> 2;
 
 	int bitmap_low = (bitmap_prio == 1) ? 0 : 2;
 	int bitmap_hi = (bitmap_low + 2) & 0x3;
 
-	if (obj0_prio == 3)
+	if (obj0_prio == 0)
 	{
-		draw_obj(0, y);
+		draw_obj(ctx, 0, y);
 	}
 
-	draw_bg(1, y);
+	draw_obj(ctx, 1, y);
 
-	if (!bg0_prio)
+	if (bg0_prio)
 	{
-		draw_bg(0, y);
+		draw_bg(ctx, 0, y);
 	}
 
-	if (obj0_prio == 2)
+	draw_bitmap(ctx, bitmap_hi, y);
+	draw_bitmap(ctx, bitmap_hi + 1, y);
+
+	if (obj0_prio == 1)
 	{
-		draw_obj(0, y);
+		draw_obj(ctx, 0, y);
 	}
 
-	draw_bitmap(bitmap_low + 1, y);
-	draw_bitmap(bitmap_low, y);
+	draw_bitmap(ctx, bitmap_low, y);
+	draw_bitmap(ctx, bitmap_low + 1, y);
 
-	if (obj0_prio == 1)
+	if (obj0_prio == 2)
 	{
-		draw_obj(0, y);
+		draw_obj(ctx, 0, y);
 	}
 
-	draw_bitmap(bitmap_hi + 1, y);
-	draw_bitmap(bitmap_hi, y);
-
-	if (bg0_prio)
+	if (!bg0_prio)
 	{
-		draw_bg(0, y);
+		draw_bg(ctx, 0, y);
 	}
 
-	draw_obj(1, y);
+	draw_bg(ctx, 1, y);
 
-	if (obj0_prio == 0)
+	if (obj0_prio == 3)
 	{
-		draw_obj(0, y);
+		draw_obj(ctx, 0, y);
 	}
 }
 
-static void draw_color_math(int y, bool half)
+//Only opaque pixels are looked up in the palette, and words of transparent ones are filled with the backdrop
+//Words outside the span aren't output, so they're filled with the backdrop too
+static void fetch_screen_colors(LineContext& ctx, uint16_t colors[2][DISPLAY_WIDTH])
 {
-	for (int x = 0; x < DISPLAY_WIDTH; x++)
+	int first_word = ctx.start_x >> 6;
+	int last_word = (ctx.end_x - 1) >> 6;
+	for (int index = 0; index < 2; index++)
 	{
-		uint16_t input_a = 0, input_b = 0;
-		if (vdp.color_prio.output_screen_a)
-		{
-			input_a = read_screen(0, x);
-		}
-
-		if (vdp.color_prio.output_screen_b)
+		uint16_t backdrop = ctx.regs.backdrops[index];
+		bool backdrop_only = uses_backdrop_only(ctx, index);
+		for (int word = 0; word < MASK_WORDS; word++)
 		{
-			input_b = read_screen(1, x);
-		}
-
-		int a_r = (input_a >> 10) & 0x1F;
-		int a_g = (input_a >> 5) & 0x1F;
-		int a_b = input_a & 0x1F;
-
-		int b_r = (input_b >> 10) & 0x1F;
-		int b_g = (input_b >> 5) & 0x1F;
-		int b_b = input_b & 0x1F;
-
-		int out_r, out_g, out_b;
-
-		if (vdp.color_prio.blend_mode)
-		{
-			//Subtractive blending
-			out_r = a_r - b_r;
-			out_g = a_g - b_g;
-			out_b = a_b - b_b;
-		}
-		else
-		{
-			//Additive blending
-			out_r = a_r + b_r;
-			out_g = a_g + b_g;
-			out_b = a_b + b_b;
-		}
-
-		if (half)
-		{
-			out_r >>= 1;
-			out_g >>= 1;
-			out_b >>= 1;
+			bool outside = word < first_word || word > last_word;
+			uint64_t mask = (backdrop_only || outside) ? 0 : ctx.opaque[index][word];
+			const uint8_t* indices = &ctx.screens[index][word * 64];
+			uint16_t* output = &colors[index][word * 64];
+			if (!mask)
+			{
+				std::fill_n(output, 64, backdrop);
+			}
+			else if (mask == ~0ULL)
+			{
+				for (int i = 0; i < 64; i++)
+				{
+					output[i] = read_palette(indices[i]);
+				}
+			}
+			else
+			{
+				//Transparent pixels are index 0, so this reads the palette for them too but doesn't branch
+				for (int i = 0; i < 64; i++)
+				{
+					uint16_t color = read_palette(indices[i]);
+					output[i] = indices[i] ? color : backdrop;
+				}
+			}
 		}
-
-		out_r = std::clamp(out_r, 0, 0x1F);
-		out_g = std::clamp(out_g, 0, 0x1F);
-		out_b = std::clamp(out_b, 0, 0x1F);
-
-		uint16_t output = (out_r << 10) | (out_g << 5) | out_b;
-		write_color(vdp.display_output, x, y, output);
 	}
 }
 
-static void draw_screen_overlay(int y, bool screen_b_prio)
+static void draw_color_math(LineContext& ctx, bool half, uint16_t colors[2][DISPLAY_WIDTH], uint16_t* output)
 {
-	for (int x = 0; x < DISPLAY_WIDTH; x++)
-	{
-		uint16_t input_a = 0, input_b = 0;
-		if (vdp.color_prio.output_screen_a)
-		{
-			input_a = read_screen(0, x);
-		}
-
-		if (vdp.color_prio.output_screen_b)
-		{
-			input_b = read_screen(1, x);
-		}
-
-		uint16_t output = 0;
-		if (screen_b_prio)
-		{
-			output = input_a;
+	static const uint16_t disabled_screen[DISPLAY_WIDTH] = {};
+	const uint16_t* input_a = ctx.regs.color_prio.output_screen_a ? colors[0] : disabled_screen;
+	const uint16_t* input_b = ctx.regs.color_prio.output_screen_b ? colors[1] : disabled_screen;
 
-			if (vdp.screens[1][x])
-			{
-				output = input_b;
-			}
-		}
-		else
-		{
-			output = input_b;
+	SIMD::color_math(input_a, input_b, output, ctx.regs.color_prio.blend_mode, half);
+}
 
-			if (vdp.screens[0][x])
-			{
-				output = input_a;
-			}
-		}
+static void draw_screen_overlay(
+	LineContext& ctx, bool screen_b_prio, uint16_t colors[2][DISPLAY_WIDTH], uint16_t* output
+)
+{
+	static const uint16_t disabled_screen[DISPLAY_WIDTH] = {};
+	const uint16_t* input_a = ctx.regs.color_prio.output_screen_a ? colors[0] : disabled_screen;
+	const uint16_t* input_b = ctx.regs.color_prio.output_screen_b ? colors[1] : disabled_screen;
 
-		write_color(vdp.display_output, x, y, output);
+	//The priority screen is on top wherever it has a pixel, even if that screen isn't output
+	if (screen_b_prio)
+	{
+		SIMD::screen_overlay(input_a, input_b, ctx.screens[1], output);
+	}
+	else
+	{
+		SIMD::screen_overlay(input_b, input_a, ctx.screens[0], output);
 	}
 }
 
-static void display_capture(int y)
+//Each segment of the capture line captures its own span, so mid-line register writes show up in the capture
+static void display_capture(LineContext& ctx, int y)
 {
+	int count = ctx.end_x - ctx.start_x;
 	uint16_t* capture_buffer_15bpp = (uint16_t*)&vdp.capture_buffer[0];
-	switch (vdp.capture_ctrl.format)
+	switch (ctx.regs.capture_ctrl.format)
 	{
 	case 0:
 		//Capture blended output in 15bpp
-		memcpy(vdp.capture_buffer, vdp.display_output.get(), DISPLAY_WIDTH * sizeof(uint16_t));
+		memcpy(&capture_buffer_15bpp[ctx.start_x], &vdp.display_output[ctx.start_x], count * sizeof(uint16_t));
 	case 1:
 		//Capture screen A in 15bpp via the palette/backdrop
-		for (int x = 0; x < DISPLAY_WIDTH; x++)
+		for (int x = ctx.start_x; x < ctx.end_x; x++)
 		{
-			capture_buffer_15bpp[x] = Common::bswp16(read_screen(0, x));
+			capture_buffer_15bpp[x] = Common::bswp16(read_screen(ctx, 0, x));
 		}
 		break;
 	case 2:
 	case 3:
 		//Capture screen A in 8bpp
-		memcpy(vdp.capture_buffer, vdp.screens[0], DISPLAY_WIDTH * sizeof(uint8_t));
+		memcpy(&vdp.capture_buffer[ctx.start_x], &ctx.screens[0][ctx.start_x], count * sizeof(uint8_t));
 		break;
 	default:
 		assert(0);
 	}
 }
 
-void draw_scanline(int y)
+void prepare_parallel()
 {
-	//Set both screens to the backdrop color
-	memset(vdp.screens, 0, sizeof(vdp.screens));
+	update_obj_lines();
 
-	draw_layers(y);
-
-	//Fetch the screen colors
-	for (int x = 0; x < DISPLAY_WIDTH; x++)
+	//Decode every stale tile up front so get_4bpp_tile never writes to the cache while lines are being drawn
+	for (int slot = 0; slot < VDP::TILE_CACHE_SLOTS; slot++)
 	{
-		uint16_t color = read_screen(0, x);
-		write_color(vdp.screen_output[0], x, y, color);
+		get_4bpp_tile(slot << 5);
+	}
+}
 
-		color = read_screen(1, x);
-		write_color(vdp.screen_output[1], x, y, color);
+bool uses_color_buffer(const RenderRegs& regs, int index)
+{
+	return regs.layer_ctrl.bitmap_enable[index] && (regs.bitmap_regs[index].buffer_ctrl & 0x100);
+}
+
+bool depends_on_previous_line(const Line& line)
+{
+	//The color buffer latch carries over from one line to the next
+	for (int i = 0; i < 4; i++)
+	{
+		if (uses_color_buffer(line.regs, i))
+		{
+			return true;
+		}
 	}
 
-	//Draw the screens to the display output buffer
-	switch (vdp.dispmode)
+	return false;
+}
+
+static void compose_line(LineContext& ctx, int y, uint16_t screen_colors[2][DISPLAY_WIDTH], uint16_t* output)
+{
+	update_obj_lines();
+
+	draw_layers(ctx, y);
+
+	//Fetch the screen colors
+	fetch_screen_colors(ctx, screen_colors);
+
+	//Draw the screens to the display output
+	switch (ctx.regs.dispmode)
 	{
 	case 0x00:
-		draw_color_math(y, false);
+		draw_color_math(ctx, false, screen_colors, output);
 		break;
 	case 0x01:
-		draw_color_math(y, true);
+		draw_color_math(ctx, true, screen_colors, output);
 		break;
 	case 0x04:
-		draw_screen_overlay(y, true);
+		draw_screen_overlay(ctx, true, screen_colors, output);
 		break;
 	case 0x05:
-		draw_screen_overlay(y, false);
+		draw_screen_overlay(ctx, false, screen_colors, output);
 		break;
 	default:
 		assert(0);
 	}
+}
+
+//Every segment of a line starts from the latched colors the line started with, whether it's drawn or skipped
+//Split lines without color buffering are drawn on any thread, where the latch never changes, so it's only written
+//back when a segment moved it. That way lines in other bands only ever read it.
+static void start_segment(const Line& line)
+{
+	uint8_t* line_latch = vdp.bitmap_line_buffered_color[line.y];
+	if (!line.start_x)
+	{
+		memcpy(line_latch, vdp.bitmap_buffered_color, sizeof(vdp.bitmap_buffered_color));
+	}
+	else if (memcmp(vdp.bitmap_buffered_color, line_latch, sizeof(vdp.bitmap_buffered_color)))
+	{
+		memcpy(vdp.bitmap_buffered_color, line_latch, sizeof(vdp.bitmap_buffered_color));
+	}
+}
+
+static void draw_segment(const Line& line)
+{
+	int y = line.y;
+	int start_x = line.start_x;
+	int count = line.end_x - start_x;
+
+	//Only the segment's span is drawn, so the layers leave what the other segments drew to the rest of the line
+	LineContext ctx(line.regs, start_x, line.end_x);
+	uint16_t screen_colors[2][DISPLAY_WIDTH];
+	uint16_t output[DISPLAY_WIDTH];
+	compose_line(ctx, y, screen_colors, output);
+
+	memcpy(&vdp.display_output[y * DISPLAY_WIDTH + start_x], &output[start_x], count * sizeof(uint16_t));
+	write_output_target(y, start_x, line.end_x);
+
+	if (vdp.screen_output[0])
+	{
+		for (int x = start_x; x < line.end_x; x++)
+		{
+			vdp.screen_output[0][y * DISPLAY_WIDTH + x] = screen_colors[0][x] | 0x8000;
+			vdp.screen_output[1][y * DISPLAY_WIDTH + x] = screen_colors[1][x] | 0x8000;
+		}
+	}
+
+	if (line.capture)
+	{
+		display_capture(ctx, y);
+	}
+}
+
+//Lines of skipped frames only process what later lines depend on, which is the color buffer latch
+//Reused lines keep what the display output already has, which still needs converting to the output target
+static void skip_scanline(const Line& line)
+{
+	write_output_target(line.y, line.start_x, line.end_x);
 
-	if (vdp.capture_enable && y == vdp.capture_ctrl.scanline)
+	//Earlier segments of the line are left alone, so the latch only advances once, with the final registers
+	if (line.end_x < DISPLAY_WIDTH)
 	{
-		display_capture(y);
-		vdp.capture_enable = false;
+		return;
+	}
+
+	LineContext ctx(line.regs);
+	for (int i = 0; i < 4; i++)
+	{
+		if (uses_color_buffer(ctx.regs, i))
+		{
+			draw_bitmap(ctx, i, line.y);
+		}
+	}
+}
+
+void draw_scanline(const Line& line)
+{
+	bool segment = line.start_x > 0 || line.end_x < DISPLAY_WIDTH;
+	if (segment)
+	{
+		start_segment(line);
+	}
+
+	//The capture line is always drawn, since the CPU can read the result
+	if (line.skip && !line.capture)
+	{
+		skip_scanline(line);
+		return;
+	}
+
+	if (segment)
+	{
+		draw_segment(line);
+		return;
+	}
+
+	int y = line.y;
+
+	LineContext ctx(line.regs);
+	uint16_t screen_colors[2][DISPLAY_WIDTH];
+	compose_line(ctx, y, screen_colors, &vdp.display_output[y * DISPLAY_WIDTH]);
+	write_output_target(y, 0, DISPLAY_WIDTH);
+
+	if (vdp.screen_output[0])
+	{
+		SIMD::copy_opaque(screen_colors[0], &vdp.screen_output[0][y * DISPLAY_WIDTH]);
+		SIMD::copy_opaque(screen_colors[1], &vdp.screen_output[1][y * DISPLAY_WIDTH]);
+	}
+
+	if (line.capture)
+	{
+		display_capture(ctx, y);
 	}
 }
 
@@ -761,10 +1158,48 @@ void draw_border_scanline(int y)
 	//Draw backdrop A to the whole scanline
 	//Note: y is relative to visible area!
 	uint16_t border_color = vdp.backdrops[0] | 0x8000;
+	//Whatever was drawn here before is gone once extra scanlines are turned back on
+	invalidate_line(y);
+	uint16_t* line = &vdp.display_output[y * DISPLAY_WIDTH];
+	if (std::all_of(line, line + DISPLAY_WIDTH, [=](uint16_t color) { return color == border_color; }))
+	{
+		return;
+	}
+
+	vdp.frame_changed = true;
 	for (int x = 0; x < DISPLAY_WIDTH; x++)
 	{
 		write_color_raw(vdp.display_output, x, y, border_color);
 	}
+	write_output_target(y, 0, DISPLAY_WIDTH);
+}
+
+void write_output_target(int y, int start_x, int end_x)
+{
+	if (!vdp.output_target)
+	{
+		return;
+	}
+
+	const uint16_t* input = &vdp.display_output[y * DISPLAY_WIDTH + start_x];
+	uint8_t* row = vdp.output_target + y * vdp.output_pitch;
+	size_t pixel_size = (vdp.output_format == OutputFormat::RGB565) ? sizeof(uint16_t) : sizeof(uint32_t);
+	convert_pixels(input, row + start_x * pixel_size, vdp.output_format, end_x - start_x);
+}
+
+void convert_pixels(const uint16_t* input, void* output, OutputFormat format, int count)
+{
+	switch (format)
+	{
+	case OutputFormat::ARGB8888:
+		SIMD::to_argb8888(input, (uint32_t*)output, count);
+		break;
+	case OutputFormat::RGB565:
+		SIMD::to_rgb565(input, (uint16_t*)output, count);
+		break;
+	default:
+		assert(0);
+	}
 }
 
 }  // namespace Video::Renderer
\ No newline at end of file
@@ -1,9 +1,72 @@
 #pragma once
+#include "video/vdp_local.h"
 
 namespace Video::Renderer
 {
 
-void draw_scanline(int y);
+//A line, or the pixels [start_x, end_x) of one, waiting to be drawn with the registers as they were when it ended
+struct Line
+{
+	int y;
+	int start_x;
+	int end_x;
+	bool capture;
+	bool skip;
+	RenderRegs regs;
+};
+
+void initialize();
+void shutdown();
+
+//Forgets what the display output lines were drawn with, so they're all drawn again
+void invalidate_lines();
+
+//Same as above for line y alone, for when its display output is written outside of the renderer
+void invalidate_line(int y);
+
+//Snapshots the registers for pixels [start_x, end_x) of line y and draws them, either right away, on the render thread
+//or at the end of the frame. Lines without mid-line writes are queued whole, which is much faster than in segments.
+void queue_scanline(int y, int start_x, int end_x);
+void draw_scanline(const Line& line);
 void draw_border_scanline(int y);
 
-}
\ No newline at end of file
+//Converts pixels [start_x, end_x) of a display output line to the output target, if there is one
+void write_output_target(int y, int start_x, int end_x);
+
+//Converts count RGB555 pixels to a host format
+void convert_pixels(const uint16_t* input, void* output, OutputFormat format, int count);
+
+//Brings the OBJ line masks and tile cache up to date, after which draw_scanline only reads shared renderer state
+void prepare_parallel();
+
+//Whether bitmap layer index is drawn with color buffering, whose latch carries over between lines
+bool uses_color_buffer(const RenderRegs& regs, int index);
+
+//Whether a line can only be drawn after the one before it. The segments of a split line only depend on each other,
+//so they can be drawn on any thread as long as they're drawn together and in order.
+bool depends_on_previous_line(const Line& line);
+
+/*
+ * With threading on, queued lines are drawn on a worker thread while emulation continues. Renderer state that isn't
+ * snapshotted (VRAM, OAM, palette, the capture buffer and the output buffers) is shared, so anything that touches it
+ * must call sync() first to wait for the queued lines to finish.
+ */
+void set_threaded(bool enable);
+bool get_threaded();
+void sync();
+
+/*
+ * Deferred rendering records every line of the frame and draws them at VSYNC, split into horizontal bands across the
+ * given number of threads (counting the emulation thread). The segments of a line split by mid-line writes stay in one
+ * band, but a frame with color buffering is drawn in order, as its latch carries over between lines. A sync() during
+ * the frame means shared state is about to change under the recorded lines, so they're drawn in order instead and the
+ * rest of the frame is drawn as it goes. Zero turns deferred rendering off, and it takes priority over the render
+ * thread.
+ */
+void set_deferred(int threads);
+int get_deferred();
+
+//Called at VSYNC: finishes drawing every line of the frame
+void finish_frame();
+
+}
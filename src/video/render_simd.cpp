@@ -0,0 +1,805 @@
+#include "video/render_simd.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "video/video.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RENDER_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace Video::Renderer::SIMD
+{
+
+//Color math is specialized on the blend mode, indexed by [subtract][half], so the per-pixel loops have no branches
+typedef void (*ColorMathFunc)(const uint16_t*, const uint16_t*, uint16_t*);
+
+#define COLOR_MATH_VARIANTS(func)                                                                                     \
+	{                                                                                                                 \
+		{func<false, false>, func<false, true>}, {func<true, false>, func<true, true>}                                \
+	}
+
+struct Impl
+{
+	const char* name;
+	ColorMathFunc color_math[2][2];
+	void (*screen_overlay)(const uint16_t*, const uint16_t*, const uint8_t*, uint16_t*);
+	void (*copy_opaque)(const uint16_t*, uint16_t*);
+	void (*expand_4bpp)(const uint8_t*, uint8_t*, int, uint8_t);
+	void (*blit_under)(const uint8_t*, uint8_t*, int);
+	void (*opaque_mask)(const uint8_t*, uint64_t*);
+	void (*to_argb8888)(const uint16_t*, uint32_t*, int);
+	void (*to_rgb565)(const uint16_t*, uint16_t*, int);
+	bool (*masked_fill)(uint8_t*, int, uint8_t, uint8_t);
+	void (*scale2x)(const uint16_t*, const uint16_t*, const uint16_t*, uint16_t* const*, int);
+	void (*scale3x)(const uint16_t*, const uint16_t*, const uint16_t*, uint16_t* const*, int);
+	void (*repeat_pixels)(const uint16_t*, uint16_t*, int, int);
+	void (*darken)(const uint16_t*, uint16_t*, int);
+};
+
+template <bool SUBTRACT, bool HALF>
+static void color_math_scalar(const uint16_t* input_a, const uint16_t* input_b, uint16_t* output)
+{
+	for (int x = 0; x < DISPLAY_WIDTH; x++)
+	{
+		int a_r = (input_a[x] >> 10) & 0x1F;
+		int a_g = (input_a[x] >> 5) & 0x1F;
+		int a_b = input_a[x] & 0x1F;
+
+		int b_r = (input_b[x] >> 10) & 0x1F;
+		int b_g = (input_b[x] >> 5) & 0x1F;
+		int b_b = input_b[x] & 0x1F;
+
+		int out_r, out_g, out_b;
+
+		if constexpr (SUBTRACT)
+		{
+			//Subtractive blending
+			out_r = a_r - b_r;
+			out_g = a_g - b_g;
+			out_b = a_b - b_b;
+		}
+		else
+		{
+			//Additive blending
+			out_r = a_r + b_r;
+			out_g = a_g + b_g;
+			out_b = a_b + b_b;
+		}
+
+		if constexpr (HALF)
+		{
+			out_r >>= 1;
+			out_g >>= 1;
+			out_b >>= 1;
+		}
+
+		out_r = std::clamp(out_r, 0, 0x1F);
+		out_g = std::clamp(out_g, 0, 0x1F);
+		out_b = std::clamp(out_b, 0, 0x1F);
+
+		output[x] = (out_r << 10) | (out_g << 5) | out_b | 0x8000;
+	}
+}
+
+static void screen_overlay_scalar(const uint16_t* bottom, const uint16_t* top, const uint8_t* top_screen,
+								  uint16_t* output)
+{
+	for (int x = 0; x < DISPLAY_WIDTH; x++)
+	{
+		output[x] = (top_screen[x] ? top[x] : bottom[x]) | 0x8000;
+	}
+}
+
+static void copy_opaque_scalar(const uint16_t* input, uint16_t* output)
+{
+	for (int x = 0; x < DISPLAY_WIDTH; x++)
+	{
+		output[x] = input[x] | 0x8000;
+	}
+}
+
+static void expand_4bpp_scalar(const uint8_t* input, uint8_t* output, int bytes, uint8_t subpalette_bits)
+{
+	for (int i = 0; i < bytes; i++)
+	{
+		uint8_t hi = input[i] >> 4;
+		uint8_t lo = input[i] & 0xF;
+		output[i * 2] = hi ? (hi | subpalette_bits) : 0;
+		output[i * 2 + 1] = lo ? (lo | subpalette_bits) : 0;
+	}
+}
+
+static void blit_under_scalar(const uint8_t* input, uint8_t* output, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (!output[i])
+		{
+			output[i] = input[i];
+		}
+	}
+}
+
+static void opaque_mask_scalar(const uint8_t* input, uint64_t* mask)
+{
+	for (int word = 0; word < DISPLAY_WIDTH / 64; word++)
+	{
+		uint64_t bits = 0;
+		for (int i = 0; i < 64; i++)
+		{
+			bits |= (uint64_t)(input[word * 64 + i] != 0) << i;
+		}
+		mask[word] = bits;
+	}
+}
+
+static bool masked_fill_scalar(uint8_t* data, int count, uint8_t mask, uint8_t value)
+{
+	uint8_t changed = 0;
+	for (int i = 0; i < count; i++)
+	{
+		uint8_t filled = (data[i] & ~mask) | (value & mask);
+		changed |= data[i] ^ filled;
+		data[i] = filled;
+	}
+	return changed;
+}
+
+static void to_argb8888_scalar(const uint16_t* input, uint32_t* output, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		uint32_t r = (input[i] >> 10) & 0x1F;
+		uint32_t g = (input[i] >> 5) & 0x1F;
+		uint32_t b = input[i] & 0x1F;
+		uint32_t a = (input[i] & 0x8000) ? 0xFF : 0;
+
+		r = (r << 3) | (r >> 2);
+		g = (g << 3) | (g >> 2);
+		b = (b << 3) | (b >> 2);
+		output[i] = (a << 24) | (r << 16) | (g << 8) | b;
+	}
+}
+
+static void to_rgb565_scalar(const uint16_t* input, uint16_t* output, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		uint16_t g = (input[i] >> 5) & 0x1F;
+		g = (g << 1) | (g >> 4);
+		output[i] = ((input[i] & 0x7C00) << 1) | (g << 5) | (input[i] & 0x1F);
+	}
+}
+
+//B, D, F and H are the neighbors above, left, right and below E. Corners only take a neighbor's color where B != H and
+//D != F, so flat areas and straight edges are left alone.
+static void scale2x_scalar(const uint16_t* above, const uint16_t* line, const uint16_t* below, uint16_t* const* output,
+						   int count)
+{
+	for (int x = 0; x < count; x++)
+	{
+		uint16_t b = above[x];
+		uint16_t d = line[x - 1];
+		uint16_t e = line[x];
+		uint16_t f = line[x + 1];
+		uint16_t h = below[x];
+
+		bool corner = b != h && d != f;
+		output[0][x * 2] = (corner && d == b) ? d : e;
+		output[0][x * 2 + 1] = (corner && b == f) ? f : e;
+		output[1][x * 2] = (corner && d == h) ? d : e;
+		output[1][x * 2 + 1] = (corner && h == f) ? f : e;
+	}
+}
+
+//Same neighbors as Scale2x, plus the diagonals A, C, G and I, which decide the edge centers
+static void scale3x_scalar(const uint16_t* above, const uint16_t* line, const uint16_t* below, uint16_t* const* output,
+						   int count)
+{
+	for (int x = 0; x < count; x++)
+	{
+		uint16_t a = above[x - 1];
+		uint16_t b = above[x];
+		uint16_t c = above[x + 1];
+		uint16_t d = line[x - 1];
+		uint16_t e = line[x];
+		uint16_t f = line[x + 1];
+		uint16_t g = below[x - 1];
+		uint16_t h = below[x];
+		uint16_t i = below[x + 1];
+
+		bool corner = b != h && d != f;
+		bool db = corner && d == b;
+		bool bf = corner && b == f;
+		bool dh = corner && d == h;
+		bool hf = corner && h == f;
+
+		uint16_t* top = &output[0][x * 3];
+		uint16_t* middle = &output[1][x * 3];
+		uint16_t* bottom = &output[2][x * 3];
+		top[0] = db ? d : e;
+		top[1] = ((db && e != c) || (bf && e != a)) ? b : e;
+		top[2] = bf ? f : e;
+		middle[0] = ((db && e != g) || (dh && e != a)) ? d : e;
+		middle[1] = e;
+		middle[2] = ((bf && e != i) || (hf && e != c)) ? f : e;
+		bottom[0] = dh ? d : e;
+		bottom[1] = ((dh && e != i) || (hf && e != g)) ? h : e;
+		bottom[2] = hf ? f : e;
+	}
+}
+
+static void repeat_pixels_scalar(const uint16_t* input, uint16_t* output, int count, int factor)
+{
+	for (int i = 0; i < count; i++)
+	{
+		std::fill_n(output + i * factor, factor, input[i]);
+	}
+}
+
+static void darken_scalar(const uint16_t* input, uint16_t* output, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		output[i] = ((input[i] >> 1) & 0x3DEF) | (input[i] & 0x8000);
+	}
+}
+
+#ifdef RENDER_SIMD_X86
+
+//Subtraction saturates at zero before halving, which matches the scalar path since negative results clamp to zero
+template <bool SUBTRACT, bool HALF>
+__attribute__((target("sse2"))) static void color_math_sse2(const uint16_t* input_a, const uint16_t* input_b,
+															 uint16_t* output)
+{
+	const __m128i max = _mm_set1_epi16(0x1F);
+	const __m128i opaque = _mm_set1_epi16((short)0x8000);
+	for (int x = 0; x < DISPLAY_WIDTH; x += 8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(input_a + x));
+		__m128i b = _mm_loadu_si128((const __m128i*)(input_b + x));
+		__m128i out = opaque;
+		for (int shift = 0; shift <= 10; shift += 5)
+		{
+			__m128i a_c = _mm_and_si128(_mm_srli_epi16(a, shift), max);
+			__m128i b_c = _mm_and_si128(_mm_srli_epi16(b, shift), max);
+			__m128i c = SUBTRACT ? _mm_subs_epu16(a_c, b_c) : _mm_add_epi16(a_c, b_c);
+			c = HALF ? _mm_srli_epi16(c, 1) : _mm_min_epi16(c, max);
+			out = _mm_or_si128(out, _mm_slli_epi16(c, shift));
+		}
+		_mm_storeu_si128((__m128i*)(output + x), out);
+	}
+}
+
+__attribute__((target("sse2"))) static void screen_overlay_sse2(const uint16_t* bottom, const uint16_t* top,
+																 const uint8_t* top_screen, uint16_t* output)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i opaque = _mm_set1_epi16((short)0x8000);
+	for (int x = 0; x < DISPLAY_WIDTH; x += 8)
+	{
+		__m128i indices = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(top_screen + x)), zero);
+		__m128i use_bottom = _mm_cmpeq_epi16(indices, zero);
+		__m128i b = _mm_loadu_si128((const __m128i*)(bottom + x));
+		__m128i t = _mm_loadu_si128((const __m128i*)(top + x));
+		__m128i out = _mm_or_si128(_mm_and_si128(use_bottom, b), _mm_andnot_si128(use_bottom, t));
+		_mm_storeu_si128((__m128i*)(output + x), _mm_or_si128(out, opaque));
+	}
+}
+
+__attribute__((target("sse2"))) static void copy_opaque_sse2(const uint16_t* input, uint16_t* output)
+{
+	const __m128i opaque = _mm_set1_epi16((short)0x8000);
+	for (int x = 0; x < DISPLAY_WIDTH; x += 8)
+	{
+		__m128i in = _mm_loadu_si128((const __m128i*)(input + x));
+		_mm_storeu_si128((__m128i*)(output + x), _mm_or_si128(in, opaque));
+	}
+}
+
+//Each step expands 8 bytes to 16 pixels
+__attribute__((target("sse2"))) static void expand_4bpp_sse2(const uint8_t* input, uint8_t* output, int bytes,
+															  uint8_t subpalette_bits)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i nibble = _mm_set1_epi8(0xF);
+	const __m128i subpalette = _mm_set1_epi8((char)subpalette_bits);
+	int i = 0;
+	for (; i + 8 <= bytes; i += 8)
+	{
+		__m128i data = _mm_loadl_epi64((const __m128i*)(input + i));
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(data, 4), nibble);
+		__m128i lo = _mm_and_si128(data, nibble);
+		__m128i pixels = _mm_unpacklo_epi8(hi, lo);
+		__m128i transparent = _mm_cmpeq_epi8(pixels, zero);
+		pixels = _mm_or_si128(pixels, _mm_andnot_si128(transparent, subpalette));
+		_mm_storeu_si128((__m128i*)(output + i * 2), pixels);
+	}
+	expand_4bpp_scalar(input + i, output + i * 2, bytes - i, subpalette_bits);
+}
+
+__attribute__((target("sse2"))) static void blit_under_sse2(const uint8_t* input, uint8_t* output, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i in = _mm_loadu_si128((const __m128i*)(input + i));
+		__m128i out = _mm_loadu_si128((const __m128i*)(output + i));
+		__m128i uncovered = _mm_cmpeq_epi8(out, zero);
+		out = _mm_or_si128(out, _mm_and_si128(uncovered, in));
+		_mm_storeu_si128((__m128i*)(output + i), out);
+	}
+	blit_under_scalar(input + i, output + i, count - i);
+}
+
+//Each step turns 16 pixels into 16 mask bits
+__attribute__((target("sse2"))) static void opaque_mask_sse2(const uint8_t* input, uint64_t* mask)
+{
+	const __m128i zero = _mm_setzero_si128();
+	for (int word = 0; word < DISPLAY_WIDTH / 64; word++)
+	{
+		uint64_t bits = 0;
+		for (int i = 0; i < 64; i += 16)
+		{
+			__m128i in = _mm_loadu_si128((const __m128i*)(input + word * 64 + i));
+			uint64_t transparent = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(in, zero));
+			bits |= (transparent ^ 0xFFFF) << i;
+		}
+		mask[word] = bits;
+	}
+}
+
+__attribute__((target("sse2"))) static bool masked_fill_sse2(uint8_t* data, int count, uint8_t mask, uint8_t value)
+{
+	const __m128i fill_mask = _mm_set1_epi8(mask);
+	const __m128i fill_value = _mm_set1_epi8(value & mask);
+	__m128i changed = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i old = _mm_loadu_si128((const __m128i*)(data + i));
+		__m128i filled = _mm_or_si128(_mm_andnot_si128(fill_mask, old), fill_value);
+		changed = _mm_or_si128(changed, _mm_xor_si128(old, filled));
+		_mm_storeu_si128((__m128i*)(data + i), filled);
+	}
+
+	bool any_changed = _mm_movemask_epi8(_mm_cmpeq_epi8(changed, _mm_setzero_si128())) != 0xFFFF;
+	return masked_fill_scalar(data + i, count - i, mask, value) || any_changed;
+}
+
+//Each step builds 8 pixels as G:B and A:R halves, then interleaves them into 32-bit pixels
+__attribute__((target("sse2"))) static void to_argb8888_sse2(const uint16_t* input, uint32_t* output, int count)
+{
+	const __m128i max = _mm_set1_epi16(0x1F);
+	const __m128i byte = _mm_set1_epi16(0xFF);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i in = _mm_loadu_si128((const __m128i*)(input + i));
+		__m128i r = _mm_and_si128(_mm_srli_epi16(in, 10), max);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(in, 5), max);
+		__m128i b = _mm_and_si128(in, max);
+		__m128i a = _mm_and_si128(_mm_srai_epi16(in, 15), byte);
+
+		r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+		g = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+		b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+		__m128i gb = _mm_or_si128(_mm_slli_epi16(g, 8), b);
+		__m128i ar = _mm_or_si128(_mm_slli_epi16(a, 8), r);
+		_mm_storeu_si128((__m128i*)(output + i), _mm_unpacklo_epi16(gb, ar));
+		_mm_storeu_si128((__m128i*)(output + i + 4), _mm_unpackhi_epi16(gb, ar));
+	}
+	to_argb8888_scalar(input + i, output + i, count - i);
+}
+
+__attribute__((target("sse2"))) static void to_rgb565_sse2(const uint16_t* input, uint16_t* output, int count)
+{
+	const __m128i red = _mm_set1_epi16(0x7C00);
+	const __m128i max = _mm_set1_epi16(0x1F);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i in = _mm_loadu_si128((const __m128i*)(input + i));
+		__m128i g = _mm_and_si128(_mm_srli_epi16(in, 5), max);
+		g = _mm_or_si128(_mm_slli_epi16(g, 1), _mm_srli_epi16(g, 4));
+
+		__m128i out = _mm_slli_epi16(_mm_and_si128(in, red), 1);
+		out = _mm_or_si128(out, _mm_slli_epi16(g, 5));
+		out = _mm_or_si128(out, _mm_and_si128(in, max));
+		_mm_storeu_si128((__m128i*)(output + i), out);
+	}
+	to_rgb565_scalar(input + i, output + i, count - i);
+}
+
+//Picks a where mask is set, otherwise b
+__attribute__((target("sse2"))) static inline __m128i select_sse2(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+__attribute__((target("sse2"))) static void scale2x_sse2(const uint16_t* above, const uint16_t* line,
+														  const uint16_t* below, uint16_t* const* output, int count)
+{
+	int x = 0;
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i b = _mm_loadu_si128((const __m128i*)(above + x));
+		__m128i d = _mm_loadu_si128((const __m128i*)(line + x - 1));
+		__m128i e = _mm_loadu_si128((const __m128i*)(line + x));
+		__m128i f = _mm_loadu_si128((const __m128i*)(line + x + 1));
+		__m128i h = _mm_loadu_si128((const __m128i*)(below + x));
+
+		__m128i flat = _mm_or_si128(_mm_cmpeq_epi16(b, h), _mm_cmpeq_epi16(d, f));
+		__m128i e0 = select_sse2(_mm_andnot_si128(flat, _mm_cmpeq_epi16(d, b)), d, e);
+		__m128i e1 = select_sse2(_mm_andnot_si128(flat, _mm_cmpeq_epi16(b, f)), f, e);
+		__m128i e2 = select_sse2(_mm_andnot_si128(flat, _mm_cmpeq_epi16(d, h)), d, e);
+		__m128i e3 = select_sse2(_mm_andnot_si128(flat, _mm_cmpeq_epi16(h, f)), f, e);
+
+		_mm_storeu_si128((__m128i*)(output[0] + x * 2), _mm_unpacklo_epi16(e0, e1));
+		_mm_storeu_si128((__m128i*)(output[0] + x * 2 + 8), _mm_unpackhi_epi16(e0, e1));
+		_mm_storeu_si128((__m128i*)(output[1] + x * 2), _mm_unpacklo_epi16(e2, e3));
+		_mm_storeu_si128((__m128i*)(output[1] + x * 2 + 8), _mm_unpackhi_epi16(e2, e3));
+	}
+
+	uint16_t* const rest[2] = {output[0] + x * 2, output[1] + x * 2};
+	scale2x_scalar(above + x, line + x, below + x, rest, count - x);
+}
+
+//SSE2 has no shuffle that interleaves three vectors, so the rules are vectorized and the results stored pixel by pixel
+__attribute__((target("sse2"))) static void scale3x_sse2(const uint16_t* above, const uint16_t* line,
+														  const uint16_t* below, uint16_t* const* output, int count)
+{
+	alignas(16) uint16_t pixels[9][8];
+	int x = 0;
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(above + x - 1));
+		__m128i b = _mm_loadu_si128((const __m128i*)(above + x));
+		__m128i c = _mm_loadu_si128((const __m128i*)(above + x + 1));
+		__m128i d = _mm_loadu_si128((const __m128i*)(line + x - 1));
+		__m128i e = _mm_loadu_si128((const __m128i*)(line + x));
+		__m128i f = _mm_loadu_si128((const __m128i*)(line + x + 1));
+		__m128i g = _mm_loadu_si128((const __m128i*)(below + x - 1));
+		__m128i h = _mm_loadu_si128((const __m128i*)(below + x));
+		__m128i i = _mm_loadu_si128((const __m128i*)(below + x + 1));
+
+		__m128i flat = _mm_or_si128(_mm_cmpeq_epi16(b, h), _mm_cmpeq_epi16(d, f));
+		__m128i db = _mm_andnot_si128(flat, _mm_cmpeq_epi16(d, b));
+		__m128i bf = _mm_andnot_si128(flat, _mm_cmpeq_epi16(b, f));
+		__m128i dh = _mm_andnot_si128(flat, _mm_cmpeq_epi16(d, h));
+		__m128i hf = _mm_andnot_si128(flat, _mm_cmpeq_epi16(h, f));
+		__m128i ea = _mm_cmpeq_epi16(e, a);
+		__m128i ec = _mm_cmpeq_epi16(e, c);
+		__m128i eg = _mm_cmpeq_epi16(e, g);
+		__m128i ei = _mm_cmpeq_epi16(e, i);
+
+		__m128i top = _mm_or_si128(_mm_andnot_si128(ec, db), _mm_andnot_si128(ea, bf));
+		__m128i left = _mm_or_si128(_mm_andnot_si128(eg, db), _mm_andnot_si128(ea, dh));
+		__m128i right = _mm_or_si128(_mm_andnot_si128(ei, bf), _mm_andnot_si128(ec, hf));
+		__m128i bottom = _mm_or_si128(_mm_andnot_si128(ei, dh), _mm_andnot_si128(eg, hf));
+
+		_mm_store_si128((__m128i*)pixels[0], select_sse2(db, d, e));
+		_mm_store_si128((__m128i*)pixels[1], select_sse2(top, b, e));
+		_mm_store_si128((__m128i*)pixels[2], select_sse2(bf, f, e));
+		_mm_store_si128((__m128i*)pixels[3], select_sse2(left, d, e));
+		_mm_store_si128((__m128i*)pixels[4], e);
+		_mm_store_si128((__m128i*)pixels[5], select_sse2(right, f, e));
+		_mm_store_si128((__m128i*)pixels[6], select_sse2(dh, d, e));
+		_mm_store_si128((__m128i*)pixels[7], select_sse2(bottom, h, e));
+		_mm_store_si128((__m128i*)pixels[8], select_sse2(hf, f, e));
+
+		for (int row = 0; row < 3; row++)
+		{
+			uint16_t* out = output[row] + x * 3;
+			for (int k = 0; k < 8; k++)
+			{
+				out[k * 3] = pixels[row * 3][k];
+				out[k * 3 + 1] = pixels[row * 3 + 1][k];
+				out[k * 3 + 2] = pixels[row * 3 + 2][k];
+			}
+		}
+	}
+
+	uint16_t* const rest[3] = {output[0] + x * 3, output[1] + x * 3, output[2] + x * 3};
+	scale3x_scalar(above + x, line + x, below + x, rest, count - x);
+}
+
+//Doubling is one unpack and quadrupling two, while other factors have no cheap shuffle and stay scalar
+__attribute__((target("sse2"))) static void repeat_pixels_sse2(const uint16_t* input, uint16_t* output, int count,
+																int factor)
+{
+	int i = 0;
+	if (factor == 2)
+	{
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i in = _mm_loadu_si128((const __m128i*)(input + i));
+			_mm_storeu_si128((__m128i*)(output + i * 2), _mm_unpacklo_epi16(in, in));
+			_mm_storeu_si128((__m128i*)(output + i * 2 + 8), _mm_unpackhi_epi16(in, in));
+		}
+	}
+	else if (factor == 4)
+	{
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i in = _mm_loadu_si128((const __m128i*)(input + i));
+			__m128i lo = _mm_unpacklo_epi16(in, in);
+			__m128i hi = _mm_unpackhi_epi16(in, in);
+			_mm_storeu_si128((__m128i*)(output + i * 4), _mm_unpacklo_epi32(lo, lo));
+			_mm_storeu_si128((__m128i*)(output + i * 4 + 8), _mm_unpackhi_epi32(lo, lo));
+			_mm_storeu_si128((__m128i*)(output + i * 4 + 16), _mm_unpacklo_epi32(hi, hi));
+			_mm_storeu_si128((__m128i*)(output + i * 4 + 24), _mm_unpackhi_epi32(hi, hi));
+		}
+	}
+	repeat_pixels_scalar(input + i, output + i * factor, count - i, factor);
+}
+
+__attribute__((target("sse2"))) static void darken_sse2(const uint16_t* input, uint16_t* output, int count)
+{
+	const __m128i channels = _mm_set1_epi16(0x3DEF);
+	const __m128i opaque = _mm_set1_epi16((short)0x8000);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i in = _mm_loadu_si128((const __m128i*)(input + i));
+		__m128i out = _mm_and_si128(_mm_srli_epi16(in, 1), channels);
+		out = _mm_or_si128(out, _mm_and_si128(in, opaque));
+		_mm_storeu_si128((__m128i*)(output + i), out);
+	}
+	darken_scalar(input + i, output + i, count - i);
+}
+
+template <bool SUBTRACT, bool HALF>
+__attribute__((target("avx2"))) static void color_math_avx2(const uint16_t* input_a, const uint16_t* input_b,
+															 uint16_t* output)
+{
+	const __m256i max = _mm256_set1_epi16(0x1F);
+	const __m256i opaque = _mm256_set1_epi16((short)0x8000);
+	for (int x = 0; x < DISPLAY_WIDTH; x += 16)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(input_a + x));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(input_b + x));
+		__m256i out = opaque;
+		for (int shift = 0; shift <= 10; shift += 5)
+		{
+			__m256i a_c = _mm256_and_si256(_mm256_srli_epi16(a, shift), max);
+			__m256i b_c = _mm256_and_si256(_mm256_srli_epi16(b, shift), max);
+			__m256i c = SUBTRACT ? _mm256_subs_epu16(a_c, b_c) : _mm256_add_epi16(a_c, b_c);
+			c = HALF ? _mm256_srli_epi16(c, 1) : _mm256_min_epi16(c, max);
+			out = _mm256_or_si256(out, _mm256_slli_epi16(c, shift));
+		}
+		_mm256_storeu_si256((__m256i*)(output + x), out);
+	}
+}
+
+__attribute__((target("avx2"))) static void screen_overlay_avx2(const uint16_t* bottom, const uint16_t* top,
+																 const uint8_t* top_screen, uint16_t* output)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i opaque = _mm256_set1_epi16((short)0x8000);
+	for (int x = 0; x < DISPLAY_WIDTH; x += 16)
+	{
+		__m256i indices = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(top_screen + x)));
+		__m256i use_bottom = _mm256_cmpeq_epi16(indices, zero);
+		__m256i b = _mm256_loadu_si256((const __m256i*)(bottom + x));
+		__m256i t = _mm256_loadu_si256((const __m256i*)(top + x));
+		__m256i out = _mm256_blendv_epi8(t, b, use_bottom);
+		_mm256_storeu_si256((__m256i*)(output + x), _mm256_or_si256(out, opaque));
+	}
+}
+
+__attribute__((target("avx2"))) static void copy_opaque_avx2(const uint16_t* input, uint16_t* output)
+{
+	const __m256i opaque = _mm256_set1_epi16((short)0x8000);
+	for (int x = 0; x < DISPLAY_WIDTH; x += 16)
+	{
+		__m256i in = _mm256_loadu_si256((const __m256i*)(input + x));
+		_mm256_storeu_si256((__m256i*)(output + x), _mm256_or_si256(in, opaque));
+	}
+}
+
+//Each step expands 16 bytes to 32 pixels
+__attribute__((target("avx2"))) static void expand_4bpp_avx2(const uint8_t* input, uint8_t* output, int bytes,
+															  uint8_t subpalette_bits)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i nibble = _mm256_set1_epi8(0xF);
+	const __m256i subpalette = _mm256_set1_epi8((char)subpalette_bits);
+	int i = 0;
+	for (; i + 16 <= bytes; i += 16)
+	{
+		//Place bytes 0-7 in the low lane and 8-15 in the high lane, so the in-lane unpack keeps pixels in order
+		__m256i data = _mm256_permute4x64_epi64(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(input + i))),
+												 0x50);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi16(data, 4), nibble);
+		__m256i lo = _mm256_and_si256(data, nibble);
+		__m256i pixels = _mm256_unpacklo_epi8(hi, lo);
+		__m256i transparent = _mm256_cmpeq_epi8(pixels, zero);
+		pixels = _mm256_or_si256(pixels, _mm256_andnot_si256(transparent, subpalette));
+		_mm256_storeu_si256((__m256i*)(output + i * 2), pixels);
+	}
+	expand_4bpp_sse2(input + i, output + i * 2, bytes - i, subpalette_bits);
+}
+
+__attribute__((target("avx2"))) static void blit_under_avx2(const uint8_t* input, uint8_t* output, int count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 32 <= count; i += 32)
+	{
+		__m256i in = _mm256_loadu_si256((const __m256i*)(input + i));
+		__m256i out = _mm256_loadu_si256((const __m256i*)(output + i));
+		out = _mm256_blendv_epi8(out, in, _mm256_cmpeq_epi8(out, zero));
+		_mm256_storeu_si256((__m256i*)(output + i), out);
+	}
+	blit_under_sse2(input + i, output + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void opaque_mask_avx2(const uint8_t* input, uint64_t* mask)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	for (int word = 0; word < DISPLAY_WIDTH / 64; word++)
+	{
+		__m256i lo = _mm256_loadu_si256((const __m256i*)(input + word * 64));
+		__m256i hi = _mm256_loadu_si256((const __m256i*)(input + word * 64 + 32));
+		uint64_t transparent = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, zero));
+		transparent |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, zero)) << 32;
+		mask[word] = ~transparent;
+	}
+}
+
+__attribute__((target("avx2"))) static bool masked_fill_avx2(uint8_t* data, int count, uint8_t mask, uint8_t value)
+{
+	const __m256i fill_mask = _mm256_set1_epi8(mask);
+	const __m256i fill_value = _mm256_set1_epi8(value & mask);
+	__m256i changed = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 32 <= count; i += 32)
+	{
+		__m256i old = _mm256_loadu_si256((const __m256i*)(data + i));
+		__m256i filled = _mm256_or_si256(_mm256_andnot_si256(fill_mask, old), fill_value);
+		changed = _mm256_or_si256(changed, _mm256_xor_si256(old, filled));
+		_mm256_storeu_si256((__m256i*)(data + i), filled);
+	}
+
+	bool any_changed = !_mm256_testz_si256(changed, changed);
+	return masked_fill_sse2(data + i, count - i, mask, value) || any_changed;
+}
+
+#endif
+
+//Every implementation the host CPU supports, widest first
+static std::vector<Impl> get_supported_impls()
+{
+	std::vector<Impl> impls;
+
+#ifdef RENDER_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		//Format conversion and scaling only run once per output line, so they share the SSE2 versions
+		impls.push_back({"AVX2", COLOR_MATH_VARIANTS(color_math_avx2), screen_overlay_avx2, copy_opaque_avx2,
+						 expand_4bpp_avx2, blit_under_avx2, opaque_mask_avx2, to_argb8888_sse2, to_rgb565_sse2,
+						 masked_fill_avx2, scale2x_sse2, scale3x_sse2, repeat_pixels_sse2, darken_sse2});
+	}
+
+	if (__builtin_cpu_supports("sse2"))
+	{
+		impls.push_back({"SSE2", COLOR_MATH_VARIANTS(color_math_sse2), screen_overlay_sse2, copy_opaque_sse2,
+						 expand_4bpp_sse2, blit_under_sse2, opaque_mask_sse2, to_argb8888_sse2, to_rgb565_sse2,
+						 masked_fill_sse2, scale2x_sse2, scale3x_sse2, repeat_pixels_sse2, darken_sse2});
+	}
+#endif
+
+	impls.push_back({"scalar", COLOR_MATH_VARIANTS(color_math_scalar), screen_overlay_scalar, copy_opaque_scalar,
+					 expand_4bpp_scalar, blit_under_scalar, opaque_mask_scalar, to_argb8888_scalar, to_rgb565_scalar,
+					 masked_fill_scalar, scale2x_scalar, scale3x_scalar, repeat_pixels_scalar, darken_scalar});
+	return impls;
+}
+
+static Impl& get_impl()
+{
+	static Impl impl = get_supported_impls().front();
+	return impl;
+}
+
+void color_math(const uint16_t* input_a, const uint16_t* input_b, uint16_t* output, bool subtract, bool half)
+{
+	get_impl().color_math[subtract][half](input_a, input_b, output);
+}
+
+void screen_overlay(const uint16_t* bottom, const uint16_t* top, const uint8_t* top_screen, uint16_t* output)
+{
+	get_impl().screen_overlay(bottom, top, top_screen, output);
+}
+
+void copy_opaque(const uint16_t* input, uint16_t* output)
+{
+	get_impl().copy_opaque(input, output);
+}
+
+void expand_4bpp(const uint8_t* input, uint8_t* output, int bytes, uint8_t subpalette_bits)
+{
+	get_impl().expand_4bpp(input, output, bytes, subpalette_bits);
+}
+
+void blit_under(const uint8_t* input, uint8_t* output, int count)
+{
+	get_impl().blit_under(input, output, count);
+}
+
+void opaque_mask(const uint8_t* input, uint64_t* mask)
+{
+	get_impl().opaque_mask(input, mask);
+}
+
+void to_argb8888(const uint16_t* input, uint32_t* output, int count)
+{
+	get_impl().to_argb8888(input, output, count);
+}
+
+void to_rgb565(const uint16_t* input, uint16_t* output, int count)
+{
+	get_impl().to_rgb565(input, output, count);
+}
+
+bool masked_fill(uint8_t* data, int count, uint8_t mask, uint8_t value)
+{
+	return get_impl().masked_fill(data, count, mask, value);
+}
+
+void scale2x(const uint16_t* above, const uint16_t* line, const uint16_t* below, uint16_t* const* output, int count)
+{
+	get_impl().scale2x(above, line, below, output, count);
+}
+
+void scale3x(const uint16_t* above, const uint16_t* line, const uint16_t* below, uint16_t* const* output, int count)
+{
+	get_impl().scale3x(above, line, below, output, count);
+}
+
+void repeat_pixels(const uint16_t* input, uint16_t* output, int count, int factor)
+{
+	get_impl().repeat_pixels(input, output, count, factor);
+}
+
+void darken(const uint16_t* input, uint16_t* output, int count)
+{
+	get_impl().darken(input, output, count);
+}
+
+const char* get_impl_name()
+{
+	return get_impl().name;
+}
+
+std::vector<const char*> get_impl_names()
+{
+	std::vector<const char*> names;
+	for (const Impl& impl : get_supported_impls())
+	{
+		names.push_back(impl.name);
+	}
+	return names;
+}
+
+bool set_impl(const char* name)
+{
+	for (const Impl& impl : get_supported_impls())
+	{
+		if (!strcmp(impl.name, name))
+		{
+			get_impl() = impl;
+			return true;
+		}
+	}
+	return false;
+}
+
+}  // namespace Video::Renderer::SIMD
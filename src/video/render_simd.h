@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace Video::Renderer::SIMD
+{
+
+/*
+ * Line helpers for the renderer. The compositing functions process DISPLAY_WIDTH pixels of RGB555 input and set bit 15
+ * on every output pixel. Each helper picks the widest implementation the host CPU supports at runtime, and every
+ * implementation gives bit-identical results to the scalar one.
+ */
+
+//Adds or subtracts screen B from screen A per channel, optionally halving, and clamps to 0-31
+void color_math(const uint16_t* input_a, const uint16_t* input_b, uint16_t* output, bool subtract, bool half);
+
+//Takes the top color wherever the top screen's palette index is non-zero, otherwise the bottom color
+void screen_overlay(const uint16_t* bottom, const uint16_t* top, const uint8_t* top_screen, uint16_t* output);
+
+//Copies a line, setting bit 15 on every pixel
+void copy_opaque(const uint16_t* input, uint16_t* output);
+
+//Expands 4bpp data into one pixel per byte, high nibble first, ORing subpalette_bits into the non-zero pixels
+void expand_4bpp(const uint8_t* input, uint8_t* output, int bytes, uint8_t subpalette_bits);
+
+//Copies count palette indices to the output wherever it's still transparent (zero)
+void blit_under(const uint8_t* input, uint8_t* output, int count);
+
+//Sets a bit for each of the DISPLAY_WIDTH palette indices that isn't transparent, 64 pixels to a word
+void opaque_mask(const uint8_t* input, uint64_t* mask);
+
+//Converts count RGB555 pixels to host formats, expanding each channel by repeating its top bits
+//For ARGB8888, bit 15 of the input becomes a fully opaque or transparent alpha
+void to_argb8888(const uint16_t* input, uint32_t* output, int count);
+void to_rgb565(const uint16_t* input, uint16_t* output, int count);
+
+//Replaces the bits of count bytes selected by mask with the same bits of value, returning whether any byte changed
+bool masked_fill(uint8_t* data, int count, uint8_t mask, uint8_t value);
+
+//Scale2x and Scale3x: scales count pixels of a line up to 2 or 3 output lines, each 2 or 3 times as wide, smoothing
+//diagonal edges using the lines above and below. Every input line must have a readable pixel before and after it.
+void scale2x(const uint16_t* above, const uint16_t* line, const uint16_t* below, uint16_t* const* output, int count);
+void scale3x(const uint16_t* above, const uint16_t* line, const uint16_t* below, uint16_t* const* output, int count);
+
+//Repeats each of count pixels factor times
+void repeat_pixels(const uint16_t* input, uint16_t* output, int count, int factor);
+
+//Halves each channel of count RGB555 pixels, keeping bit 15
+void darken(const uint16_t* input, uint16_t* output, int count);
+
+//Name of the implementation in use, for logging
+const char* get_impl_name();
+
+//Names of the implementations the host CPU supports, widest first, and switching between them for testing
+//Switching isn't thread-safe, so it has to happen while nothing is drawing
+std::vector<const char*> get_impl_names();
+bool set_impl(const char* name);
+
+}  // namespace Video::Renderer::SIMD
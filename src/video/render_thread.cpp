@@ -0,0 +1,394 @@
+#include "video/render.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Video::Renderer
+{
+
+//Lines are only queued during the visible region and the queue is drained at VSYNC, so one frame's worth is enough
+constexpr static int QUEUE_SIZE = DISPLAY_HEIGHT;
+
+static bool threaded;
+static std::thread worker;
+static bool stopping;
+
+//The queue is a ring buffer. A line stays in it until it's drawn, so the producer never overwrites one in progress.
+static Line queue[QUEUE_SIZE];
+static int queue_head;
+static std::atomic<int> queue_count;
+
+static std::mutex queue_mutex;
+static std::condition_variable work_cv;
+static std::condition_variable done_cv;
+
+//More bands than this just adds wakeup overhead for a 240 line frame
+constexpr static int MAX_BAND_THREADS = 8;
+
+static int deferred_threads;
+
+//Lines of the current frame waiting for VSYNC in deferred mode, in the order they ended
+static Line frame_lines[DISPLAY_HEIGHT];
+static int frame_line_count;
+
+//Set once a sync() forced the frame to be drawn in order, so the rest of it is drawn as each line ends
+static bool frame_in_order;
+
+//Band threads draw band N (starting from 1) each time band_generation changes, while the caller draws band 0
+static std::vector<std::thread> band_workers;
+static std::mutex band_mutex;
+static std::condition_variable band_start_cv;
+static std::condition_variable band_done_cv;
+static int band_generation;
+static int bands_left;
+static bool bands_stopping;
+
+//The first of the frame lines each band draws, followed by the end of the last band
+static int band_starts[MAX_BAND_THREADS + 1];
+
+//Lines split by mid-line writes are reused a segment at a time, for up to this many segments
+constexpr static int MAX_DRAWN_SEGMENTS = 4;
+
+//What pixels [start_x, end_x) of a display output line were last drawn with
+struct DrawnSegment
+{
+	int start_x;
+	int end_x;
+	uint32_t generation;
+	RenderRegs regs;
+};
+
+//What each line of the display output was last drawn with. A segment drawn again over the same pixels with the same
+//registers and VDP memory would come out the same, so it's reused instead.
+static DrawnSegment drawn_segments[DISPLAY_HEIGHT][MAX_DRAWN_SEGMENTS];
+static int drawn_segment_count[DISPLAY_HEIGHT];
+
+//Which segment of its line the last queued one was
+static int queued_segment;
+
+static void worker_thread()
+{
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	while (true)
+	{
+		work_cv.wait(lock, [] { return stopping || queue_count.load(); });
+		if (!queue_count.load())
+		{
+			return;
+		}
+
+		Line& line = queue[queue_head];
+		lock.unlock();
+		draw_scanline(line);
+		lock.lock();
+
+		queue_head = (queue_head + 1) % QUEUE_SIZE;
+		queue_count.fetch_sub(1, std::memory_order_release);
+		done_cv.notify_all();
+	}
+}
+
+static void start_worker()
+{
+	queue_head = 0;
+	queue_count = 0;
+	stopping = false;
+	worker = std::thread(worker_thread);
+}
+
+static void stop_worker()
+{
+	if (!worker.joinable())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		stopping = true;
+	}
+	work_cv.notify_one();
+	worker.join();
+}
+
+//Splits the frame lines into bands of about the same size, keeping the segments of each split line in one band
+static void split_bands(int band_count)
+{
+	band_starts[0] = 0;
+	for (int band = 1; band < band_count; band++)
+	{
+		int start = std::max(band * frame_line_count / band_count, band_starts[band - 1]);
+		while (start < frame_line_count && frame_lines[start].start_x > 0)
+		{
+			start++;
+		}
+		band_starts[band] = start;
+	}
+	band_starts[band_count] = frame_line_count;
+}
+
+static void draw_band(int band)
+{
+	for (int i = band_starts[band]; i < band_starts[band + 1]; i++)
+	{
+		draw_scanline(frame_lines[i]);
+	}
+}
+
+static void band_thread(int band, int generation)
+{
+	std::unique_lock<std::mutex> lock(band_mutex);
+	while (true)
+	{
+		band_start_cv.wait(lock, [&] { return bands_stopping || band_generation != generation; });
+		if (bands_stopping)
+		{
+			return;
+		}
+		generation = band_generation;
+
+		lock.unlock();
+		draw_band(band);
+		lock.lock();
+
+		if (!--bands_left)
+		{
+			band_done_cv.notify_one();
+		}
+	}
+}
+
+static void start_band_workers()
+{
+	bands_stopping = false;
+	for (int i = 1; i < deferred_threads; i++)
+	{
+		band_workers.emplace_back(band_thread, i, band_generation);
+	}
+}
+
+static void stop_band_workers()
+{
+	{
+		std::lock_guard<std::mutex> lock(band_mutex);
+		bands_stopping = true;
+	}
+	band_start_cv.notify_all();
+
+	for (std::thread& band_worker : band_workers)
+	{
+		band_worker.join();
+	}
+	band_workers.clear();
+}
+
+static void draw_frame_lines(bool allow_parallel)
+{
+	bool parallel = allow_parallel && !band_workers.empty();
+	for (int i = 0; i < frame_line_count && parallel; i++)
+	{
+		parallel = !depends_on_previous_line(frame_lines[i]);
+	}
+
+	if (!parallel)
+	{
+		split_bands(1);
+		draw_band(0);
+		frame_line_count = 0;
+		return;
+	}
+
+	prepare_parallel();
+	split_bands(deferred_threads);
+
+	{
+		std::lock_guard<std::mutex> lock(band_mutex);
+		bands_left = band_workers.size();
+		band_generation++;
+	}
+	band_start_cv.notify_all();
+
+	draw_band(0);
+
+	std::unique_lock<std::mutex> lock(band_mutex);
+	band_done_cv.wait(lock, [] { return !bands_left; });
+	frame_line_count = 0;
+}
+
+static bool reuse_line(int y, int start_x, int end_x)
+{
+	//Segments of a line are queued left to right, so each is compared with the one in the same place last time
+	int segment = start_x ? queued_segment + 1 : 0;
+	queued_segment = segment;
+
+	if (segment < drawn_segment_count[y])
+	{
+		const DrawnSegment& drawn = drawn_segments[y][segment];
+		if (drawn.start_x == start_x && drawn.end_x == end_x && drawn.generation == vdp.memory_generation &&
+			!memcmp(&drawn.regs, static_cast<RenderRegs*>(&vdp), sizeof(RenderRegs)))
+		{
+			return true;
+		}
+	}
+
+	//Layer capture clears the layers every frame, and the color buffer latch carries over between lines, so neither
+	//can be reused. Neither can lines split into more segments than are kept.
+	bool reusable = segment < MAX_DRAWN_SEGMENTS && !vdp.bg_output[0];
+	for (int i = 0; i < 4; i++)
+	{
+		reusable &= !uses_color_buffer(vdp, i);
+	}
+
+	drawn_segment_count[y] = reusable ? segment + 1 : 0;
+	if (reusable)
+	{
+		drawn_segments[y][segment] = {start_x, end_x, vdp.memory_generation, vdp};
+	}
+	vdp.frame_changed = true;
+	return false;
+}
+
+void invalidate_lines()
+{
+	memset(drawn_segment_count, 0, sizeof(drawn_segment_count));
+}
+
+void invalidate_line(int y)
+{
+	drawn_segment_count[y] = 0;
+}
+
+void initialize()
+{
+	finish_frame();
+	invalidate_lines();
+	if (deferred_threads > 1 && band_workers.empty())
+	{
+		start_band_workers();
+	}
+	else if (!deferred_threads && threaded && !worker.joinable())
+	{
+		start_worker();
+	}
+}
+
+void shutdown()
+{
+	stop_worker();
+	stop_band_workers();
+	frame_line_count = 0;
+}
+
+void queue_scanline(int y, int start_x, int end_x)
+{
+	//The capture request is consumed here so it applies to the line being queued, not whichever one is drawn next
+	//Every segment of the capture line captures its span, and the request is consumed once the line is finished
+	bool capture = vdp.capture_enable && y == vdp.capture_ctrl.scanline;
+	if (capture && end_x == DISPLAY_WIDTH)
+	{
+		vdp.capture_enable = false;
+	}
+
+	//Lines of skipped frames don't touch the display output, so they leave what was last drawn there
+	bool skip = vdp.skip_render || reuse_line(y, start_x, end_x);
+	if (capture && vdp.skip_render)
+	{
+		//Except for the capture line, which is drawn anyway
+		drawn_segment_count[y] = 0;
+	}
+
+	if (deferred_threads && !frame_in_order)
+	{
+		frame_lines[frame_line_count++] = {y, start_x, end_x, capture, skip, vdp};
+		if (frame_line_count == DISPLAY_HEIGHT)
+		{
+			draw_frame_lines(true);
+		}
+		return;
+	}
+
+	if (!worker.joinable())
+	{
+		draw_scanline({y, start_x, end_x, capture, skip, vdp});
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	done_cv.wait(lock, [] { return queue_count.load() < QUEUE_SIZE; });
+
+	queue[(queue_head + queue_count.load()) % QUEUE_SIZE] = {y, start_x, end_x, capture, skip, vdp};
+	queue_count.fetch_add(1, std::memory_order_release);
+	work_cv.notify_one();
+}
+
+void set_threaded(bool enable)
+{
+	threaded = enable;
+	if (enable)
+	{
+		initialize();
+	}
+	else
+	{
+		stop_worker();
+	}
+}
+
+bool get_threaded()
+{
+	return threaded;
+}
+
+void sync()
+{
+	if (frame_line_count)
+	{
+		draw_frame_lines(false);
+		frame_in_order = true;
+	}
+
+	//Cheap enough to call on every VRAM write: there's nothing to wait for unless lines are queued
+	if (!queue_count.load(std::memory_order_acquire))
+	{
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	done_cv.wait(lock, [] { return !queue_count.load(); });
+}
+
+void set_deferred(int threads)
+{
+	finish_frame();
+	stop_band_workers();
+
+	deferred_threads = std::clamp(threads, 0, MAX_BAND_THREADS);
+	if (deferred_threads)
+	{
+		stop_worker();
+	}
+	initialize();
+}
+
+int get_deferred()
+{
+	return deferred_threads;
+}
+
+void finish_frame()
+{
+	if (frame_line_count)
+	{
+		draw_frame_lines(true);
+	}
+	frame_in_order = false;
+
+	sync();
+}
+
+}  // namespace Video::Renderer
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "video/render.h"
+#include "video/render_simd.h"
+#include "video/vdp_local.h"
+
+namespace Video
+{
+
+namespace SIMD = Renderer::SIMD;
+
+//Copies a display output line with its edge pixels repeated one past either end, for the scalers that read neighbors
+static void pad_line(const uint16_t* line, uint16_t* padded)
+{
+	padded[0] = line[0];
+	memcpy(padded + 1, line, DISPLAY_WIDTH * sizeof(uint16_t));
+	padded[DISPLAY_WIDTH + 1] = line[DISPLAY_WIDTH - 1];
+}
+
+int get_scale_factor(Scaler scaler, int factor)
+{
+	switch (scaler)
+	{
+	case Scaler::NEAREST:
+		return std::clamp(factor, 1, MAX_SCALE_FACTOR);
+	case Scaler::SCALE2X:
+		return 2;
+	case Scaler::SCALE3X:
+		return 3;
+	case Scaler::SCANLINES:
+		return std::clamp(factor, 2, MAX_SCALE_FACTOR);
+	default:
+		assert(0);
+		return 1;
+	}
+}
+
+void scale_display_output(void* pixels, int pitch, OutputFormat format, Scaler scaler, int factor)
+{
+	Renderer::sync();
+	factor = get_scale_factor(scaler, factor);
+
+	int width = DISPLAY_WIDTH * factor;
+	size_t row_size = width * ((format == OutputFormat::RGB565) ? sizeof(uint16_t) : sizeof(uint32_t));
+
+	//Scaling is done in RGB555, then each output row is converted to the host format
+	uint16_t padded[3][DISPLAY_WIDTH + 2];
+	uint16_t scaled[MAX_SCALE_FACTOR][DISPLAY_WIDTH * MAX_SCALE_FACTOR];
+	uint16_t* const scaled_rows[MAX_SCALE_FACTOR] = {scaled[0], scaled[1], scaled[2], scaled[3]};
+
+	for (int y = 0; y < DISPLAY_HEIGHT; y++)
+	{
+		const uint16_t* line = &vdp.display_output[y * DISPLAY_WIDTH];
+		uint8_t* rows = (uint8_t*)pixels + y * factor * pitch;
+
+		switch (scaler)
+		{
+		case Scaler::NEAREST:
+		case Scaler::SCANLINES:
+		{
+			//Every row of a line comes out the same, so it's converted once and copied, except for the darkened scanline
+			int same_rows = (scaler == Scaler::SCANLINES) ? factor - 1 : factor;
+			SIMD::repeat_pixels(line, scaled[0], DISPLAY_WIDTH, factor);
+			Renderer::convert_pixels(scaled[0], rows, format, width);
+			for (int i = 1; i < same_rows; i++)
+			{
+				memcpy(rows + i * pitch, rows, row_size);
+			}
+
+			if (scaler == Scaler::SCANLINES)
+			{
+				SIMD::darken(scaled[0], scaled[1], width);
+				Renderer::convert_pixels(scaled[1], rows + same_rows * pitch, format, width);
+			}
+			break;
+		}
+		case Scaler::SCALE2X:
+		case Scaler::SCALE3X:
+		{
+			//The top and bottom lines are their own neighbors past the edge of the display
+			pad_line(&vdp.display_output[std::max(y - 1, 0) * DISPLAY_WIDTH], padded[0]);
+			pad_line(line, padded[1]);
+			pad_line(&vdp.display_output[std::min(y + 1, DISPLAY_HEIGHT - 1) * DISPLAY_WIDTH], padded[2]);
+
+			if (scaler == Scaler::SCALE2X)
+			{
+				SIMD::scale2x(padded[0] + 1, padded[1] + 1, padded[2] + 1, scaled_rows, DISPLAY_WIDTH);
+			}
+			else
+			{
+				SIMD::scale3x(padded[0] + 1, padded[1] + 1, padded[2] + 1, scaled_rows, DISPLAY_WIDTH);
+			}
+
+			for (int i = 0; i < factor; i++)
+			{
+				Renderer::convert_pixels(scaled[i], rows + i * pitch, format, width);
+			}
+			break;
+		}
+		default:
+			assert(0);
+		}
+	}
+}
+
+}  // namespace Video
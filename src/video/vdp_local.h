@@ -1,67 +1,18 @@
 #pragma once
 #include <memory>
+#include <type_traits>
 #include "video/video.h"
 
 namespace Video
 {
 
-struct VDP
+/*
+ * Registers read by the renderer. A copy is taken for each line as it ends, which lets the line be drawn later or on
+ * another thread while the CPU keeps writing to the live registers. Copies are compared with memcmp to find lines that
+ * haven't changed, so fields are ordered to leave no padding.
+ */
+struct RenderRegs
 {
-	//16-bit color output of the layers, screens, and final image to be displayed
-	std::unique_ptr<uint16_t[]> bg_output[2];
-	std::unique_ptr<uint16_t[]> bitmap_output[4];
-	std::unique_ptr<uint16_t[]> obj_output[2];
-	std::unique_ptr<uint16_t[]> screen_output[2];
-	std::unique_ptr<uint16_t[]> display_output;
-
-	int frame_ended;
-	int visible_scanlines; //Configured by VDP_MODE
-
-	//Screen A is 0, Screen B is 1
-	uint8_t screens[2][DISPLAY_WIDTH];
-
-	//Bitmap VRAM - 0x0C000000
-	uint8_t bitmap[BITMAP_VRAM_SIZE];
-
-	//Tile VRAM - 0x0C040000
-	uint8_t tile[TILE_VRAM_SIZE];
-
-	//OAM - 0x0C050000
-	uint8_t oam[OAM_SIZE];
-
-	//Palette - 0x0C051000
-	uint8_t palette[PALETTE_SIZE];
-
-	//Display capture buffer - 0x0C052000
-	uint8_t capture_buffer[CAPTURE_SIZE];
-
-	//Control registers - 0x0C058xxx
-
-	struct Mode
-	{
-		int use_pal;
-		int extra_scanlines;
-		int unk;
-		int mouse_scan;
-		int pad_scan;
-		int unk2;
-	};
-
-	Mode mode;
-
-	uint16_t hcount;
-	uint16_t vcount;
-
-	struct SyncIrqCtrl
-	{
-		int irq1_enable;
-		int irq1_source;
-	};
-
-	SyncIrqCtrl sync_irq_ctrl;
-
-	int capture_enable;
-
 	//Bitmap registers - 0x0C059xxx
 	struct BitmapRegs
 	{
@@ -73,8 +24,6 @@ struct VDP
 		uint16_t clipx;
 		uint16_t h;
 		uint16_t buffer_ctrl;
-
-		uint8_t buffered_color;
 	};
 
 	BitmapRegs bitmap_regs[4];
@@ -95,7 +44,6 @@ struct VDP
 	uint16_t bg_scrollx[2];
 	uint16_t bg_scrolly[2];
 	uint16_t bg_palsel[2];
-	uint16_t tilebase;
 
 	struct ObjCtrl
 	{
@@ -106,11 +54,11 @@ struct VDP
 
 	ObjCtrl obj_ctrl;
 	uint16_t obj_palsel[2];
+	uint16_t tilebase;
 
 	//Display registers - 0x0C05Bxxx
-
 	uint16_t dispmode;
-	
+
 	struct LayerCtrl
 	{
 		int bg_enable[2];
@@ -141,6 +89,106 @@ struct VDP
 	};
 
 	CaptureCtrl capture_ctrl;
+};
+
+static_assert(std::has_unique_object_representations_v<RenderRegs>, "RenderRegs must not contain padding");
+
+struct VDP : RenderRegs
+{
+	//16-bit color output of the layers, screens, and final image to be displayed
+	//The layer and screen buffers are only for debugging, and are null unless layer capture is enabled
+	std::unique_ptr<uint16_t[]> bg_output[2];
+	std::unique_ptr<uint16_t[]> bitmap_output[4];
+	std::unique_ptr<uint16_t[]> obj_output[2];
+	std::unique_ptr<uint16_t[]> screen_output[2];
+	std::unique_ptr<uint16_t[]> display_output;
+
+	//Frontend buffer the final image is also written to in a host pixel format, null when there isn't one
+	uint8_t* output_target;
+	int output_pitch;
+	OutputFormat output_format;
+
+	int frame_ended;
+
+	//Set by the frontend for frames it won't show, whose lines are queued but not drawn
+	bool skip_render;
+
+	//Incremented by every write that changes VRAM, OAM or the palette
+	uint32_t memory_generation;
+
+	//Set when anything in the display output changed this frame, rather than every line being reused
+	bool frame_changed;
+
+	int visible_scanlines; //Configured by VDP_MODE
+
+	//Bitmap VRAM - 0x0C000000
+	uint8_t bitmap[BITMAP_VRAM_SIZE];
+
+	//Tile VRAM - 0x0C040000
+	uint8_t tile[TILE_VRAM_SIZE];
+
+	//OAM - 0x0C050000
+	uint8_t oam[OAM_SIZE];
+
+	//4bpp tiles decoded to one byte per pixel, indexed by the tile's 32-byte slot in tile VRAM
+	//Slots are decoded on first use and invalidated by CPU writes to tile VRAM
+	constexpr static int TILE_CACHE_SLOTS = TILE_VRAM_SIZE / 32;
+	uint8_t tile_cache[TILE_CACHE_SLOTS][64];
+	uint64_t tile_cache_valid[TILE_CACHE_SLOTS / 64];
+
+	//Bitmask of the OBJs intersecting each line, updated by the renderer for OAM entries marked dirty by writes
+	uint64_t obj_line_mask[DISPLAY_HEIGHT][2];
+	uint64_t obj_dirty[2];
+	uint16_t obj_line_start[OBJ_COUNT];
+	uint8_t obj_line_count[OBJ_COUNT];
+
+	//Palette - 0x0C051000
+	uint8_t palette[PALETTE_SIZE];
+
+	//The palette in host byte order, kept in sync by palette writes so the renderer can index it directly
+	uint16_t palette_colors[PALETTE_SIZE / 2];
+
+	//Display capture buffer - 0x0C052000
+	uint8_t capture_buffer[CAPTURE_SIZE];
+
+	//Control registers - 0x0C058xxx
+
+	struct Mode
+	{
+		int use_pal;
+		int extra_scanlines;
+		int unk;
+		int mouse_scan;
+		int pad_scan;
+		int unk2;
+	};
+
+	Mode mode;
+
+	//The beam position is computed on demand: vcount holds the line that started at line_start
+	int64_t line_start;
+	uint16_t vcount;
+
+	//Pixels of the current line already queued because a write changed the VDP state mid-line
+	int line_drawn_x;
+
+	struct SyncIrqCtrl
+	{
+		int irq1_enable;
+		int irq1_source;
+	};
+
+	SyncIrqCtrl sync_irq_ctrl;
+
+	int capture_enable;
+
+	//Bitmap, BG/OBJ, and display registers are in RenderRegs
+
+	//Latched color for each bitmap layer's color buffering, which carries over between lines
+	uint8_t bitmap_buffered_color[4];
+
+	//The latched colors as each line started, so each segment of a split line starts from the same state
+	uint8_t bitmap_line_buffered_color[DISPLAY_HEIGHT][4];
 
 	//IRQ control registers (not to be confused with 58008) - 0x0C05Cxxx
 	struct CmpIrqCtrl
@@ -7,13 +7,16 @@
 #include <core/timing.h>
 #include <log/log.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <limits>
+#include <vector>
 
 #include "video/render.h"
+#include "video/render_simd.h"
 #include "video/vdp_local.h"
 
 namespace imagew = Common::ImageWriter;
@@ -21,11 +24,13 @@ namespace imagew = Common::ImageWriter;
 namespace Video
 {
 
-static Timing::FuncHandle vcount_func, hsync_func;
-static Timing::EventHandle vcount_ev, hsync_ev;
+static Timing::FuncHandle vcount_func, hsync_func, irq0_func;
+static Timing::EventHandle vcount_ev, hsync_ev, irq0_ev;
 
 VDP vdp;
 
+static bool layer_capture;
+
 constexpr static int LINES_PER_FRAME = 263;
 
 struct DumpHeader
@@ -37,6 +42,12 @@ struct DumpHeader
 
 void dump_all_bmps(int image_type, fs::path base_path)
 {
+	if (!layer_capture)
+	{
+		Log::warn("[Video] layer capture is disabled, there are no layers to dump");
+		return;
+	}
+
 	fs::path image_ext = imagew::image_extension(image_type);
 
 	for (int i = 0; i < 4; i++)
@@ -80,30 +91,221 @@ void dump_all_bmps(int image_type, fs::path base_path)
 	);
 }
 
-static void start_hsync(uint64_t param, int cycles_late)
+constexpr static int CYCLES_PER_FRAME = Timing::F_CPU / 60;
+constexpr static int CYCLES_PER_LINE = CYCLES_PER_FRAME / LINES_PER_FRAME;
+constexpr static int CYCLES_UNTIL_HSYNC = (CYCLES_PER_LINE * 256.0f) / 341.25f;
+
+//At the end of VSYNC, wrap around to the start of the visible region
+constexpr static int VSYNC_END = 0x200;
+
+static int64_t get_line_time()
+{
+	return Timing::get_timestamp(Timing::CPU_TIMER) - vdp.line_start;
+}
+
+static uint16_t get_vcount()
+{
+	//Line events are only skipped where VCOUNT increments normally, so it can be extrapolated from the last one
+	return vdp.vcount + get_line_time() / CYCLES_PER_LINE;
+}
+
+static int get_beam_x()
+{
+	return (get_line_time() % CYCLES_PER_LINE) * DISPLAY_WIDTH / CYCLES_UNTIL_HSYNC;
+}
+
+//Draws the current line up to the beam, so a write in the active display only affects the pixels after it
+static void catch_up()
+{
+	if (vdp.vcount >= vdp.visible_scanlines)
+	{
+		return;
+	}
+
+	int x = get_beam_x();
+	if (x <= vdp.line_drawn_x || x >= DISPLAY_WIDTH)
+	{
+		return;
+	}
+
+	Renderer::queue_scanline(vdp.vcount, vdp.line_drawn_x, x);
+	vdp.line_drawn_x = x;
+}
+
+static uint16_t get_hcount()
 {
-	vdp.hcount |= 0x100;
-	//IRQ0 is triggered every line and uses hcmp/vcmp
-	//For now hcmp is not emulated but we just assume it happens at the same time as HSYNC
-	if (vdp.cmp_irq_ctrl.irq0_enable && vdp.cmp_irq_ctrl.irq0_enable2)
+	//FIXME: This only reflects HSYNC status, it doesn't actually return the horizontal counter
+	return (get_line_time() % CYCLES_PER_LINE >= CYCLES_UNTIL_HSYNC) ? 0x100 : 0;
+}
+
+//One entry of the write log, packed into 16 bytes
+struct WriteLogEntry
+{
+	uint32_t frame;
+	uint32_t addr;
+	uint32_t value;
+	uint16_t line;
+
+	//0 to DISPLAY_WIDTH - 1 in the active display, and DISPLAY_WIDTH for any write during HBLANK
+	uint16_t x : 12;
+	uint16_t size : 4;
+};
+
+//Ring buffer of the newest writes. The count keeps going past the capacity, so it also tells how many were overwritten.
+static std::vector<WriteLogEntry> write_log;
+static uint64_t write_log_count;
+static uint32_t write_log_frame;
+
+//Records a write as the CPU made it, before byte swapping, along with where the beam was
+static void log_write(uint32_t addr, uint32_t value, int size)
+{
+	if (write_log.empty())
+	{
+		return;
+	}
+
+	WriteLogEntry& entry = write_log[write_log_count++ % write_log.size()];
+	entry.frame = write_log_frame;
+	entry.addr = addr;
+	entry.value = value;
+	entry.line = get_vcount();
+	entry.x = std::min(get_beam_x(), DISPLAY_WIDTH);
+	entry.size = size;
+}
+
+static const char* get_write_region_name(uint32_t addr)
+{
+	struct Region
+	{
+		uint32_t start;
+		uint32_t end;
+		const char* name;
+	};
+
+	constexpr static Region regions[] = {
+		{PALETTE_START, PALETTE_END, "palette"},
+		{OAM_START, OAM_END, "oam"},
+		{CTRL_REG_START, CTRL_REG_END, "ctrl"},
+		{BITMAP_REG_START, BITMAP_REG_END, "bitmap_reg"},
+		{BGOBJ_REG_START, BGOBJ_REG_END, "bgobj"},
+		{DISPLAY_REG_START, DISPLAY_REG_END, "display"},
+		{IRQ_REG_START, IRQ_REG_END, "irq"},
+		{DMA_CTRL_START, DMA_CTRL_END, "dma_ctrl"},
+		{DMA_START, DMA_END, "dma"},
+	};
+
+	for (const Region& region : regions)
 	{
-		if (!vdp.cmp_irq_ctrl.use_vcmp || vdp.vcount == vdp.irq0_vcmp)
+		if (addr >= region.start && addr < region.end)
 		{
-			auto irq_id = SH2::OCPM::INTC::IRQ::IRQ0;
-			SH2::OCPM::INTC::assert_irq(irq_id, 0);
-			SH2::OCPM::INTC::deassert_irq(irq_id);
+			return region.name;
 		}
 	}
+	return "unknown";
+}
+
+static void schedule_hsync()
+{
+	if (hsync_ev.is_valid())
+	{
+		Timing::cancel_event(hsync_ev);
+	}
+
+	//HSYNC has no side effects other than IRQ1, so only schedule it when that's enabled
+	if (!vdp.sync_irq_ctrl.irq1_enable || vdp.sync_irq_ctrl.irq1_source != 1)
+	{
+		return;
+	}
+
+	int64_t line_time = get_line_time();
+	int64_t cycles = CYCLES_UNTIL_HSYNC - line_time % CYCLES_PER_LINE;
+	if (cycles <= 0)
+	{
+		cycles += CYCLES_PER_LINE;
+	}
+
+	hsync_ev = Timing::add_event(hsync_func, Timing::convert_cpu(cycles), 0, Timing::CPU_TIMER);
+}
+
+static void schedule_irq0()
+{
+	if (irq0_ev.is_valid())
+	{
+		Timing::cancel_event(irq0_ev);
+	}
+
+	if (!vdp.cmp_irq_ctrl.irq0_enable || !vdp.cmp_irq_ctrl.irq0_enable2)
+	{
+		return;
+	}
+
+	//HCMP counts dots, 341.25 of which make up a line. Compare values past the end of the line never match.
+	int64_t hcmp_time = (int64_t)vdp.irq0_hcmp * CYCLES_PER_LINE * 4 / 1365;
+	if (hcmp_time >= CYCLES_PER_LINE)
+	{
+		return;
+	}
+
+	int64_t cycles = hcmp_time - get_line_time() % CYCLES_PER_LINE;
+	if (cycles <= 0)
+	{
+		cycles += CYCLES_PER_LINE;
+	}
+
+	irq0_ev = Timing::add_event(irq0_func, Timing::convert_cpu(cycles), 0, Timing::CPU_TIMER);
+}
+
+static void schedule_vcount()
+{
+	if (vcount_ev.is_valid())
+	{
+		Timing::cancel_event(vcount_ev);
+	}
+
+	//Catch up to the current line, which is safe because nothing happens between the events scheduled here
+	int64_t lines = get_line_time() / CYCLES_PER_LINE;
+	vdp.vcount += lines;
+	vdp.line_start += lines * CYCLES_PER_LINE;
+
+	//Visible lines need to be drawn one by one. Otherwise, nothing happens until the end of VSYNC.
+	int64_t next_line = 1;
+	if (vdp.vcount >= vdp.visible_scanlines)
+	{
+		next_line = VSYNC_END - vdp.vcount;
+	}
+
+	int64_t cycles = next_line * CYCLES_PER_LINE - get_line_time();
+	vcount_ev = Timing::add_event(vcount_func, Timing::convert_cpu(cycles), 0, Timing::CPU_TIMER);
+}
+
+static void start_hsync(uint64_t param, int cycles_late)
+{
+	hsync_ev = Timing::EventHandle();
+
 	//IRQ1 is triggered on visible lines when in HSYNC mode
-	if (vdp.sync_irq_ctrl.irq1_enable && vdp.sync_irq_ctrl.irq1_source == 1)
+	if (get_vcount() < vdp.visible_scanlines)
 	{
-		if (vdp.vcount < vdp.visible_scanlines)
-		{
-			auto irq_id = SH2::OCPM::INTC::IRQ::IRQ1;
-			SH2::OCPM::INTC::assert_irq(irq_id, 0);
-			SH2::OCPM::INTC::deassert_irq(irq_id);
-		}
+		auto irq_id = SH2::OCPM::INTC::IRQ::IRQ1;
+		SH2::OCPM::INTC::assert_irq(irq_id, 0);
+		SH2::OCPM::INTC::deassert_irq(irq_id);
 	}
+
+	schedule_hsync();
+}
+
+static void irq0_hcmp(uint64_t param, int cycles_late)
+{
+	irq0_ev = Timing::EventHandle();
+
+	//IRQ0 is triggered when the beam reaches hcmp, on every line or only on the vcmp line
+	if (!vdp.cmp_irq_ctrl.use_vcmp || get_vcount() == vdp.irq0_vcmp)
+	{
+		auto irq_id = SH2::OCPM::INTC::IRQ::IRQ0;
+		SH2::OCPM::INTC::assert_irq(irq_id, 0);
+		SH2::OCPM::INTC::deassert_irq(irq_id);
+	}
+
+	schedule_irq0();
 }
 
 static void vsync_start()
@@ -114,6 +316,10 @@ static void vsync_start()
 	//Think of the VSYNC lines as being negative
 	vdp.vcount = (vdp.vcount - LINES_PER_FRAME) & 0x1FF;
 	vdp.frame_ended = true;
+	write_log_frame++;
+
+	//The frame is only complete once every line is drawn, whether queued on the render thread or deferred until now
+	Renderer::finish_frame();
 
 	//NMI is triggered on VSYNC
 	if (vdp.cmp_irq_ctrl.nmi_enable)
@@ -139,14 +345,20 @@ static void vsync_start()
 
 static void inc_vcount(uint64_t param, int cycles_late)
 {
+	vcount_ev = Timing::EventHandle();
+
 	//Leave HSYNC
-	vdp.hcount &= ~0x100;
+	//Draw whatever is left of the line, which is all of it unless a write split it
 	if (vdp.vcount < vdp.visible_scanlines)
 	{
-		Renderer::draw_scanline(vdp.vcount);
+		Renderer::queue_scanline(vdp.vcount, vdp.line_drawn_x, DISPLAY_WIDTH);
+		vdp.line_drawn_x = 0;
 	}
 
-	vdp.vcount++;
+	//Every line skipped since the last event was in VSYNC, where VCOUNT just counts up
+	int64_t now = Timing::get_timestamp(Timing::CPU_TIMER) - cycles_late;
+	vdp.vcount += (now - vdp.line_start) / CYCLES_PER_LINE;
+	vdp.line_start = now;
 
 	//Once we go past the visible region, enter VSYNC
 	if (vdp.vcount == vdp.visible_scanlines)
@@ -154,9 +366,6 @@ static void inc_vcount(uint64_t param, int cycles_late)
 		vsync_start();
 	}
 
-	//At the end of VSYNC, wrap around to the start of the visible region
-	constexpr static int VSYNC_END = 0x200;
-
 	if (vdp.vcount == VSYNC_END)
 	{
 		Log::debug("[Video] VSYNC end");
@@ -172,15 +381,7 @@ static void inc_vcount(uint64_t param, int cycles_late)
 		}
 	}
 
-	constexpr static int CYCLES_PER_FRAME = Timing::F_CPU / 60;
-	constexpr static int CYCLES_PER_LINE = CYCLES_PER_FRAME / LINES_PER_FRAME;
-	constexpr static int CYCLES_UNTIL_HSYNC = (CYCLES_PER_LINE * 256.0f) / 341.25f;
-
-	Timing::UnitCycle scanline_cycles = Timing::convert_cpu(CYCLES_PER_LINE - cycles_late);
-	vcount_ev = Timing::add_event(vcount_func, scanline_cycles, 0, Timing::CPU_TIMER);
-
-	Timing::UnitCycle hsync_cycles = Timing::convert_cpu(CYCLES_UNTIL_HSYNC - cycles_late);
-	hsync_ev = Timing::add_event(hsync_func, hsync_cycles, 0, Timing::CPU_TIMER);
+	schedule_vcount();
 }
 
 static void dump_serial_region(std::ofstream& dump, uint8_t* mem, uint32_t addr, uint32_t length)
@@ -196,17 +397,16 @@ static void dump_serial_region(std::ofstream& dump, uint8_t* mem, uint32_t addr,
 
 void initialize()
 {
+	Renderer::initialize();
+
 	vdp = {};
 
 	vdp.visible_scanlines = 0xE0;
 
 	//Initialize output buffers
-	for (int i = 0; i < 2; i++)
-	{
-		vdp.bg_output[i] = std::make_unique<uint16_t[]>(DISPLAY_WIDTH * DISPLAY_HEIGHT);
-		vdp.obj_output[i] = std::make_unique<uint16_t[]>(DISPLAY_WIDTH * DISPLAY_HEIGHT);
-		vdp.screen_output[i] = std::make_unique<uint16_t[]>(DISPLAY_WIDTH * DISPLAY_HEIGHT);
-	}
+	set_layer_capture(layer_capture);
+
+	Log::debug("[Video] compositing with %s", Renderer::SIMD::get_impl_name());
 
 	//Set all OBJs to invisible
 	for (int i = 0; i < OAM_SIZE; i += 4)
@@ -214,48 +414,152 @@ void initialize()
 		oam_write32(i, 0x200);
 	}
 
-	for (int i = 0; i < 4; i++)
-	{
-		vdp.bitmap_output[i] = std::make_unique<uint16_t[]>(DISPLAY_WIDTH * DISPLAY_HEIGHT);
-	}
-
 	vdp.display_output = std::make_unique<uint16_t[]>(DISPLAY_WIDTH * DISPLAY_HEIGHT);
 
-	//Map VRAM to the CPU
+	//Map VRAM to the CPU for reads. Writes go through MMIO to keep the render thread and tile cache up to date.
 	//Bitmap VRAM is mirrored
-	Memory::map_sh2_pagetable(vdp.bitmap, BITMAP_VRAM_START, BITMAP_VRAM_SIZE);
-	Memory::map_sh2_pagetable(vdp.bitmap, BITMAP_VRAM_START + BITMAP_VRAM_SIZE, BITMAP_VRAM_SIZE);
-	Memory::map_sh2_pagetable(vdp.tile, TILE_VRAM_START, TILE_VRAM_SIZE);
+	Memory::map_sh2_pagetable_read_only(vdp.bitmap, BITMAP_VRAM_START, BITMAP_VRAM_SIZE);
+	Memory::map_sh2_pagetable_read_only(vdp.bitmap, BITMAP_VRAM_START + BITMAP_VRAM_SIZE, BITMAP_VRAM_SIZE);
+
+	Memory::map_sh2_pagetable_read_only(vdp.tile, TILE_VRAM_START, TILE_VRAM_SIZE);
 
 	vcount_func = Timing::register_func("Video::inc_vcount", inc_vcount);
 	hsync_func = Timing::register_func("Video::start_hsync", start_hsync);
+	irq0_func = Timing::register_func("Video::irq0_hcmp", irq0_hcmp);
+	vcount_ev = {};
+	hsync_ev = {};
+	irq0_ev = {};
 
 	//Kickstart the VCOUNT event
+	vdp.line_start = Timing::get_timestamp(Timing::CPU_TIMER) - CYCLES_PER_LINE;
 	inc_vcount(0, 0);
 }
 
 void shutdown()
 {
-	// nop
+	Renderer::shutdown();
 }
 
 void start_frame()
 {
+	Renderer::sync();
 	vdp.frame_ended = false;
+	vdp.frame_changed = false;
 
-	constexpr static int BUFFER_SIZE = DISPLAY_WIDTH * DISPLAY_HEIGHT;
+	//Skipped frames leave the last drawn one in the output buffers
+	if (vdp.skip_render)
+	{
+		return;
+	}
+
+	constexpr static int BUFFER_SIZE = DISPLAY_WIDTH * DISPLAY_HEIGHT * sizeof(uint16_t);
 
 	//Clear the output buffers
+	if (layer_capture)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			memset(vdp.bg_output[i].get(), 0, BUFFER_SIZE);
+			memset(vdp.obj_output[i].get(), 0, BUFFER_SIZE);
+			memset(vdp.bitmap_output[i].get(), 0, BUFFER_SIZE);
+			memset(vdp.bitmap_output[i + 2].get(), 0, BUFFER_SIZE);
+			memset(vdp.screen_output[i].get(), 0, BUFFER_SIZE);
+		}
+	}
+
+	//Lines are only redrawn when something they depend on changed, so the display output is kept between frames.
+	//The border line is drawn at VSYNC end, and anything below it is left over from when extra scanlines were on.
+	//Those lines must be drawn again if extra scanlines are turned back on, so they can't be reused.
+	int clear_start = vdp.visible_scanlines + 1;
+	for (int y = clear_start; y < DISPLAY_HEIGHT; y++)
+	{
+		Renderer::invalidate_line(y);
+		uint16_t* line = &vdp.display_output[y * DISPLAY_WIDTH];
+		if (std::any_of(line, line + DISPLAY_WIDTH, [](uint16_t color) { return color; }))
+		{
+			memset(line, 0, DISPLAY_WIDTH * sizeof(uint16_t));
+			Renderer::write_output_target(y, 0, DISPLAY_WIDTH);
+			vdp.frame_changed = true;
+		}
+	}
+}
+
+void set_layer_capture(bool enable)
+{
+	Renderer::sync();
+	Renderer::invalidate_lines();
+	layer_capture = enable;
+
 	for (int i = 0; i < 2; i++)
 	{
-		memset(vdp.bg_output[i].get(), 0, BUFFER_SIZE);
-		memset(vdp.obj_output[i].get(), 0, BUFFER_SIZE);
-		memset(vdp.bitmap_output[i].get(), 0, BUFFER_SIZE);
-		memset(vdp.bitmap_output[i + 2].get(), 0, BUFFER_SIZE);
-		memset(vdp.screen_output[i].get(), 0, BUFFER_SIZE);
+		vdp.bg_output[i] = enable ? std::make_unique<uint16_t[]>(DISPLAY_WIDTH * DISPLAY_HEIGHT) : nullptr;
+		vdp.obj_output[i] = enable ? std::make_unique<uint16_t[]>(DISPLAY_WIDTH * DISPLAY_HEIGHT) : nullptr;
+		vdp.screen_output[i] = enable ? std::make_unique<uint16_t[]>(DISPLAY_WIDTH * DISPLAY_HEIGHT) : nullptr;
 	}
 
-	memset(vdp.display_output.get(), 0, BUFFER_SIZE);
+	for (int i = 0; i < 4; i++)
+	{
+		vdp.bitmap_output[i] = enable ? std::make_unique<uint16_t[]>(DISPLAY_WIDTH * DISPLAY_HEIGHT) : nullptr;
+	}
+}
+
+void set_output_target(void* pixels, int pitch, OutputFormat format)
+{
+	Renderer::sync();
+	vdp.output_target = (uint8_t*)pixels;
+	vdp.output_pitch = pitch;
+	vdp.output_format = format;
+
+	//Lines past the visible area aren't drawn every frame, so fill them in from the display output
+	for (int y = vdp.visible_scanlines; y < DISPLAY_HEIGHT; y++)
+	{
+		Renderer::write_output_target(y, 0, DISPLAY_WIDTH);
+	}
+}
+
+bool get_layer_capture()
+{
+	return layer_capture;
+}
+
+void set_threaded_render(bool enable)
+{
+	Renderer::set_threaded(enable);
+}
+
+bool get_threaded_render()
+{
+	return Renderer::get_threaded();
+}
+
+void set_deferred_render(int threads)
+{
+	Renderer::set_deferred(threads);
+}
+
+int get_deferred_render()
+{
+	return Renderer::get_deferred();
+}
+
+void set_skip_render(bool skip)
+{
+	vdp.skip_render = skip;
+}
+
+bool is_frame_changed()
+{
+	Renderer::sync();
+	return vdp.frame_changed;
+}
+
+void copy_to_output_target()
+{
+	Renderer::sync();
+	for (int y = 0; y < DISPLAY_HEIGHT; y++)
+	{
+		Renderer::write_output_target(y, 0, DISPLAY_WIDTH);
+	}
 }
 
 bool check_frame_end()
@@ -285,9 +589,25 @@ void dump_current_frame(int image_type, fs::path bmp_path)
 		imagew::save_image_16bpp(image_type, bmp_path, DISPLAY_WIDTH, vdp.visible_scanlines, vdp.display_output.get());
 }
 
-void dump_for_serial()
+//Dumps count registers starting at start + offset, as the CPU would read them back
+static void dump_serial_registers(
+	std::ofstream& dump, uint16_t (*read16)(uint32_t), uint32_t start, uint32_t offset, size_t count
+)
 {
-	std::ofstream dump("emudump.bin", std::ios::binary);
+	uint8_t data[0x80];
+	assert(count * 2 <= sizeof(data));
+	for (size_t i = 0; i < count; i++)
+	{
+		uint16_t value = Common::bswp16(read16(start + offset + i * 2));
+		memcpy(&data[i * 2], &value, 2);
+	}
+
+	dump_serial_region(dump, data, start + offset, count * 2);
+}
+
+void dump_for_serial(fs::path path)
+{
+	std::ofstream dump(path, std::ios::binary);
 	const char* MAGIC = "LPSTATE\0";
 
 	dump.write(MAGIC, 8);
@@ -297,7 +617,268 @@ void dump_for_serial()
 	dump_serial_region(dump, vdp.palette, PALETTE_START, PALETTE_SIZE);
 	dump_serial_region(dump, vdp.oam, OAM_START, OAM_SIZE);
 
-	//TODO: dump MMIO
+	//Registers that affect rendering, in runs without gaps. Counters, IRQ, capture and DMA registers are left out.
+	dump_serial_registers(dump, ctrl_read16, CTRL_REG_START, 0x000, 1);
+	dump_serial_registers(dump, bitmap_reg_read16, BITMAP_REG_START, 0x000, 25);
+	dump_serial_registers(dump, bitmap_reg_read16, BITMAP_REG_START, 0x040, 1);
+	dump_serial_registers(dump, bitmap_reg_read16, BITMAP_REG_START, 0x050, 4);
+	dump_serial_registers(dump, bgobj_read16, BGOBJ_REG_START, 0x000, 7);
+	dump_serial_registers(dump, bgobj_read16, BGOBJ_REG_START, 0x010, 3);
+	dump_serial_registers(dump, bgobj_read16, BGOBJ_REG_START, 0x020, 1);
+	dump_serial_registers(dump, display_read16, DISPLAY_REG_START, 0x000, 5);
+}
+
+//Writes a halfword of a dump to whichever part of the VDP it was read from
+static bool load_serial16(uint32_t addr, uint16_t value)
+{
+	if (addr >= BITMAP_VRAM_START && addr < BITMAP_VRAM_END)
+	{
+		bitmap_write16(addr, value);
+	}
+	else if (addr >= TILE_VRAM_START && addr < TILE_VRAM_END)
+	{
+		tile_write16(addr, value);
+	}
+	else if (addr >= PALETTE_START && addr < PALETTE_END)
+	{
+		palette_write16(addr, value);
+	}
+	else if (addr >= OAM_START && addr < OAM_END)
+	{
+		oam_write16(addr, value);
+	}
+	else if (addr >= CTRL_REG_START && addr < CTRL_REG_END)
+	{
+		ctrl_write16(addr, value);
+	}
+	else if (addr >= BITMAP_REG_START && addr < BITMAP_REG_END)
+	{
+		bitmap_reg_write16(addr, value);
+	}
+	else if (addr >= BGOBJ_REG_START && addr < BGOBJ_REG_END)
+	{
+		bgobj_write16(addr, value);
+	}
+	else if (addr >= DISPLAY_REG_START && addr < DISPLAY_REG_END)
+	{
+		display_write16(addr, value);
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+bool load_serial_dump(fs::path path)
+{
+	std::ifstream dump(path, std::ios::binary);
+	char magic[8];
+	if (!dump.read(magic, 8) || memcmp(magic, "LPSTATE\0", 8))
+	{
+		Log::error("[Video] %s is not a state dump", path.string().c_str());
+		return false;
+	}
+
+	DumpHeader header;
+	while (dump.read((char*)&header, sizeof(header)))
+	{
+		uint32_t addr = Common::bswp32(header.addr) & ~(1 << 27);
+		uint32_t length = Common::bswp32(header.length);
+		if (Common::bswp32(header.data_width) != 2 || (length & 1))
+		{
+			Log::error("[Video] %s: region %08X has an unsupported data width or length", path.string().c_str(), addr);
+			return false;
+		}
+
+		std::vector<uint8_t> data(length);
+		if (!dump.read((char*)data.data(), length))
+		{
+			Log::error("[Video] %s: region %08X is truncated", path.string().c_str(), addr);
+			return false;
+		}
+
+		for (uint32_t i = 0; i < length; i += 2)
+		{
+			if (!load_serial16(addr + i, (data[i] << 8) | data[i + 1]))
+			{
+				Log::error("[Video] %s: %08X is not part of the VDP", path.string().c_str(), addr + i);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void set_write_log(int capacity)
+{
+	write_log.assign(std::max(capacity, 0), {});
+	write_log_count = 0;
+	write_log_frame = 0;
+}
+
+bool export_write_log(fs::path path, WriteLogFormat format)
+{
+	if (write_log.empty())
+	{
+		Log::warn("[Video] the write log is disabled, there is nothing to export");
+		return false;
+	}
+
+	FILE* file = fopen(path.string().c_str(), "w");
+	if (!file)
+	{
+		Log::error("[Video] could not open %s for writing", path.string().c_str());
+		return false;
+	}
+
+	bool json = format == WriteLogFormat::JSON;
+	fprintf(file, json ? "[\n" : "frame,line,x,region,addr,size,value\n");
+
+	//Entries are written oldest first, starting after the newest one once the ring buffer has wrapped around
+	uint64_t count = std::min<uint64_t>(write_log_count, write_log.size());
+	for (uint64_t i = write_log_count - count; i < write_log_count; i++)
+	{
+		const WriteLogEntry& entry = write_log[i % write_log.size()];
+		const char* region = get_write_region_name(entry.addr);
+		int digits = entry.size * 2;
+		if (json)
+		{
+			fprintf(file,
+					"  {\"frame\": %u, \"line\": %u, \"x\": %u, \"region\": \"%s\", \"addr\": \"%08X\", \"size\": %u, "
+					"\"value\": \"%0*X\"}%s\n",
+					entry.frame, entry.line, entry.x, region, entry.addr, entry.size, digits, entry.value,
+					(i + 1 < write_log_count) ? "," : "");
+		}
+		else
+		{
+			fprintf(file, "%u,%u,%u,%s,%08X,%u,%0*X\n", entry.frame, entry.line, entry.x, region, entry.addr,
+					entry.size, digits, entry.value);
+		}
+	}
+
+	if (json)
+	{
+		fprintf(file, "]\n");
+	}
+
+	bool ok = !ferror(file);
+	fclose(file);
+	Log::info("[Video] exported %llu writes, of %llu logged, to %s", (unsigned long long)count,
+			  (unsigned long long)write_log_count, path.string().c_str());
+	return ok;
+}
+
+uint8_t bitmap_read8(uint32_t addr)
+{
+	return vdp.bitmap[addr & (BITMAP_VRAM_SIZE - 1)];
+}
+
+uint16_t bitmap_read16(uint32_t addr)
+{
+	uint16_t value;
+	memcpy(&value, &vdp.bitmap[addr & (BITMAP_VRAM_SIZE - 2)], 2);
+	return Common::bswp16(value);
+}
+
+uint32_t bitmap_read32(uint32_t addr)
+{
+	uint32_t value;
+	memcpy(&value, &vdp.bitmap[addr & (BITMAP_VRAM_SIZE - 4)], 4);
+	return Common::bswp32(value);
+}
+
+/*
+ * Writes to VRAM, OAM or the palette, returning whether the contents changed. Writes that change nothing are dropped,
+ * so they don't wait for the render thread, split lines or stop lines being reused.
+ * Games draw to bitmap VRAM throughout the frame, so those writes don't catch up to the beam: splitting the line at
+ * every write would draw it in hundreds of segments.
+ */
+static bool write_memory(uint8_t* dest, const void* src, int size, bool catch_up_beam)
+{
+	if (!memcmp(dest, src, size))
+	{
+		return false;
+	}
+
+	if (catch_up_beam)
+	{
+		catch_up();
+	}
+
+	Renderer::sync();
+	memcpy(dest, src, size);
+	vdp.memory_generation++;
+	return true;
+}
+
+void bitmap_write8(uint32_t addr, uint8_t value)
+{
+	write_memory(&vdp.bitmap[addr & (BITMAP_VRAM_SIZE - 1)], &value, 1, false);
+}
+
+void bitmap_write16(uint32_t addr, uint16_t value)
+{
+	value = Common::bswp16(value);
+	write_memory(&vdp.bitmap[addr & (BITMAP_VRAM_SIZE - 2)], &value, 2, false);
+}
+
+void bitmap_write32(uint32_t addr, uint32_t value)
+{
+	value = Common::bswp32(value);
+	write_memory(&vdp.bitmap[addr & (BITMAP_VRAM_SIZE - 4)], &value, 4, false);
+}
+
+static void invalidate_tile(uint32_t addr)
+{
+	int slot = (addr & (TILE_VRAM_SIZE - 1)) >> 5;
+	vdp.tile_cache_valid[slot >> 6] &= ~(1ULL << (slot & 0x3F));
+}
+
+uint8_t tile_read8(uint32_t addr)
+{
+	return vdp.tile[addr & (TILE_VRAM_SIZE - 1)];
+}
+
+uint16_t tile_read16(uint32_t addr)
+{
+	uint16_t value;
+	memcpy(&value, &vdp.tile[addr & (TILE_VRAM_SIZE - 2)], 2);
+	return Common::bswp16(value);
+}
+
+uint32_t tile_read32(uint32_t addr)
+{
+	uint32_t value;
+	memcpy(&value, &vdp.tile[addr & (TILE_VRAM_SIZE - 4)], 4);
+	return Common::bswp32(value);
+}
+
+void tile_write8(uint32_t addr, uint8_t value)
+{
+	if (write_memory(&vdp.tile[addr & (TILE_VRAM_SIZE - 1)], &value, 1, true))
+	{
+		invalidate_tile(addr);
+	}
+}
+
+void tile_write16(uint32_t addr, uint16_t value)
+{
+	value = Common::bswp16(value);
+	if (write_memory(&vdp.tile[addr & (TILE_VRAM_SIZE - 2)], &value, 2, true))
+	{
+		invalidate_tile(addr);
+	}
+}
+
+void tile_write32(uint32_t addr, uint32_t value)
+{
+	value = Common::bswp32(value);
+	if (write_memory(&vdp.tile[addr & (TILE_VRAM_SIZE - 4)], &value, 4, true))
+	{
+		invalidate_tile(addr);
+	}
 }
 
 uint8_t palette_read8(uint32_t addr)
@@ -319,21 +900,42 @@ uint32_t palette_read32(uint32_t addr)
 	return Common::bswp32(value);
 }
 
+static void update_palette_color(uint32_t addr)
+{
+	int index = (addr & 0x1FF) >> 1;
+	uint16_t color;
+	memcpy(&color, &vdp.palette[index * 2], 2);
+	vdp.palette_colors[index] = Common::bswp16(color);
+}
+
 void palette_write8(uint32_t addr, uint8_t value)
 {
-	vdp.palette[addr & 0x1FF] = value;
+	log_write(PALETTE_START | (addr & 0x1FF), value, 1);
+	if (write_memory(&vdp.palette[addr & 0x1FF], &value, 1, true))
+	{
+		update_palette_color(addr);
+	}
 }
 
 void palette_write16(uint32_t addr, uint16_t value)
 {
+	log_write(PALETTE_START | (addr & 0x1FE), value, 2);
 	value = Common::bswp16(value);
-	memcpy(&vdp.palette[addr & 0x1FE], &value, 2);
+	if (write_memory(&vdp.palette[addr & 0x1FE], &value, 2, true))
+	{
+		update_palette_color(addr);
+	}
 }
 
 void palette_write32(uint32_t addr, uint32_t value)
 {
+	log_write(PALETTE_START | (addr & 0x1FE), value, 4);
 	value = Common::bswp32(value);
-	memcpy(&vdp.palette[addr & 0x1FE], &value, 4);
+	if (write_memory(&vdp.palette[addr & 0x1FE], &value, 4, true))
+	{
+		update_palette_color(addr);
+		update_palette_color(addr + 2);
+	}
 }
 
 uint8_t oam_read8(uint32_t addr)
@@ -355,30 +957,51 @@ uint32_t oam_read32(uint32_t addr)
 	return Common::bswp32(value);
 }
 
+static void mark_obj_dirty(uint32_t addr)
+{
+	int id = (addr & 0x1FF) >> 2;
+	vdp.obj_dirty[id >> 6] |= 1ULL << (id & 0x3F);
+}
+
 void oam_write8(uint32_t addr, uint8_t value)
 {
-	vdp.oam[addr & 0x1FF] = value;
+	log_write(OAM_START | (addr & 0x1FF), value, 1);
+	if (write_memory(&vdp.oam[addr & 0x1FF], &value, 1, true))
+	{
+		mark_obj_dirty(addr);
+	}
 }
 
 void oam_write16(uint32_t addr, uint16_t value)
 {
+	log_write(OAM_START | (addr & 0x1FE), value, 2);
 	value = Common::bswp16(value);
-	memcpy(&vdp.oam[addr & 0x1FE], &value, 2);
+	if (write_memory(&vdp.oam[addr & 0x1FE], &value, 2, true))
+	{
+		mark_obj_dirty(addr);
+	}
 }
 
 void oam_write32(uint32_t addr, uint32_t value)
 {
+	log_write(OAM_START | (addr & 0x1FE), value, 4);
 	value = Common::bswp32(value);
-	memcpy(&vdp.oam[addr & 0x1FE], &value, 4);
+	if (write_memory(&vdp.oam[addr & 0x1FE], &value, 4, true))
+	{
+		mark_obj_dirty(addr);
+		mark_obj_dirty(addr + 2);
+	}
 }
 
 uint8_t capture_read8(uint32_t addr)
 {
+	Renderer::sync();
 	return vdp.capture_buffer[addr & 0x1FF];
 }
 
 uint16_t capture_read16(uint32_t addr)
 {
+	Renderer::sync();
 	uint16_t value;
 	memcpy(&value, &vdp.capture_buffer[addr & 0x1FE], 2);
 	return Common::bswp16(value);
@@ -386,6 +1009,7 @@ uint16_t capture_read16(uint32_t addr)
 
 uint32_t capture_read32(uint32_t addr)
 {
+	Renderer::sync();
 	uint32_t value;
 	memcpy(&value, &vdp.capture_buffer[addr & 0x1FE], 4);
 	return Common::bswp32(value);
@@ -457,6 +1081,8 @@ void bitmap_reg_write8(uint32_t addr, uint8_t value)
 
 void bitmap_reg_write16(uint32_t addr, uint16_t value)
 {
+	log_write(BITMAP_REG_START | (addr & 0xFFE), value, 2);
+	catch_up();
 	addr &= 0xFFE;
 
 	int index = (addr >> 1) & 0x3;
@@ -533,10 +1159,9 @@ uint16_t ctrl_read16(uint32_t addr)
 		return result;
 	}
 	case 0x002:
-		//FIXME: This only reflects HSYNC status, it doesn't actually return the horizontal counter
-		return vdp.hcount;
+		return get_hcount();
 	case 0x004:
-		return vdp.vcount;
+		return get_vcount();
 	default:
 		assert(0);
 		return 0;
@@ -555,6 +1180,7 @@ void ctrl_write8(uint32_t addr, uint8_t value)
 
 void ctrl_write16(uint32_t addr, uint16_t value)
 {
+	log_write(CTRL_REG_START | (addr & 0xFFE), value, 2);
 	addr &= 0xFFE;
 	switch (addr)
 	{
@@ -570,6 +1196,9 @@ void ctrl_write16(uint32_t addr, uint16_t value)
 
 		vdp.visible_scanlines = (vdp.mode.extra_scanlines) ? 0xF0 : 0xE0;
 		LoopyIO::set_controller_scan_mode(vdp.mode.pad_scan, vdp.mode.mouse_scan);
+
+		//The end of the visible region may have moved
+		schedule_vcount();
 		break;
 	case 0x006:
 		if (value & 0x01)
@@ -597,6 +1226,7 @@ void ctrl_write16(uint32_t addr, uint16_t value)
 		Log::debug("[Video] write SYNC_IRQ_CTRL: %04X", value);
 		vdp.sync_irq_ctrl.irq1_enable = value & 0x1;
 		vdp.sync_irq_ctrl.irq1_source = (value >> 1) & 0x1;
+		schedule_hsync();
 		break;
 	default:
 		assert(0);
@@ -671,6 +1301,8 @@ void bgobj_write8(uint32_t addr, uint8_t value)
 
 void bgobj_write16(uint32_t addr, uint16_t value)
 {
+	log_write(BGOBJ_REG_START | (addr & 0xFFE), value, 2);
+	catch_up();
 	addr &= 0xFFE;
 	switch (addr)
 	{
@@ -804,6 +1436,8 @@ void display_write8(uint32_t addr, uint8_t value)
 
 void display_write16(uint32_t addr, uint16_t value)
 {
+	log_write(DISPLAY_REG_START | (addr & 0xFFE), value, 2);
+	catch_up();
 	addr &= 0xFFE;
 	switch (addr)
 	{
@@ -891,20 +1525,22 @@ void irq_write8(uint32_t addr, uint8_t value)
 
 void irq_write16(uint32_t addr, uint16_t value)
 {
+	log_write(IRQ_REG_START | (addr & 0xFFE), value, 2);
 	addr &= 0xFFE;
 
 	switch (addr)
 	{
 	case 0x000:
-		//TODO: emulate IRQ0, a screen position compare interrupt (no game uses it, but homebrew might)
 		vdp.cmp_irq_ctrl.irq0_enable = (value >> 1) & 0x1;
 		vdp.cmp_irq_ctrl.nmi_enable = (value >> 2) & 0x1;
 		vdp.cmp_irq_ctrl.use_vcmp = (value >> 5) & 0x1;
 		vdp.cmp_irq_ctrl.irq0_enable2 = (value >> 7) & 0x1;
 		Log::debug("[VDP] write CMP_IRQ_CTRL: %04X", value);
+		schedule_irq0();
 		break;
 	case 0x002:
 		vdp.irq0_hcmp = value & 0x1FF;
+		schedule_irq0();
 		break;
 	case 0x004:
 		vdp.irq0_vcmp = value & 0x1FF;
@@ -949,6 +1585,7 @@ void dma_ctrl_write8(uint32_t addr, uint8_t value)
 
 void dma_ctrl_write16(uint32_t addr, uint16_t value)
 {
+	log_write(DMA_CTRL_START | (addr & 0xFFE), value, 2);
 	addr &= 0xFFE;
 	switch (addr)
 	{
@@ -995,26 +1632,34 @@ void dma_write8(uint32_t addr, uint8_t value)
 	WRITE_HALFWORD(dma, addr, value);
 }
 
-void dma_write16(uint32_t addr, uint16_t value)
+//Applies the DMA fill to count consecutive rows of bitmap VRAM, starting from row y, in one pass
+//TODO: how long does this take? Is the CPU stalled?
+static void dma_fill_rows(int y, int count)
 {
-	//Value written doesn't matter, it always triggers this
-	//TODO: how long does this take? Is the CPU stalled?
-	addr &= 0x3FE;
-
-	int y = addr >> 1;
-	for (int x = 0; x < DISPLAY_WIDTH; x++)
+	Renderer::sync();
+	uint8_t* rows = &vdp.bitmap[y * DISPLAY_WIDTH];
+	if (Renderer::SIMD::masked_fill(rows, count * DISPLAY_WIDTH, vdp.dma_mask, vdp.dma_value))
 	{
-		uint32_t addr = x + (y * DISPLAY_WIDTH);
-		uint8_t data = vdp.bitmap[addr];
-		data &= ~vdp.dma_mask;
-		data |= vdp.dma_value & vdp.dma_mask;
-		vdp.bitmap[addr] = data;
+		//Clearing rows that are already clear leaves lines drawn from them reusable
+		vdp.memory_generation++;
 	}
 }
 
+void dma_write16(uint32_t addr, uint16_t value)
+{
+	log_write(DMA_START | (addr & 0xFFE), value, 2);
+
+	//Value written doesn't matter, it always triggers this
+	dma_fill_rows((addr & 0x3FE) >> 1, 1);
+}
+
 void dma_write32(uint32_t addr, uint32_t value)
 {
-	WRITE_DOUBLEWORD(dma, addr, value);
+	log_write(DMA_START | (addr & 0xFFE), value, 4);
+
+	//Both halves trigger a fill, and their rows are next to each other in VRAM
+	//Fills can't be batched across writes, as the CPU reads bitmap VRAM directly without going through the VDP
+	dma_fill_rows((addr & 0x3FC) >> 1, 2);
 }
 
 }  // namespace Video
\ No newline at end of file
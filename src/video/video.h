@@ -16,6 +16,7 @@ constexpr static int DISPLAY_HEIGHT = 0xF0;
 constexpr static int BITMAP_VRAM_START = 0x04000000;
 constexpr static int BITMAP_VRAM_SIZE = 0x20000;
 constexpr static int BITMAP_VRAM_END = BITMAP_VRAM_START + BITMAP_VRAM_SIZE;
+constexpr static int BITMAP_VRAM_MIRROR_END = BITMAP_VRAM_END + BITMAP_VRAM_SIZE;
 
 constexpr static int TILE_VRAM_START = 0x04040000;
 constexpr static int TILE_VRAM_SIZE = 0x10000;
@@ -61,15 +62,103 @@ void shutdown();
 
 void start_frame();
 bool check_frame_end();
+
+//Frames started while skipping are emulated without being drawn, for frontends that won't show them
+//The display capture line is still drawn, and IRQ timing is unaffected
+void set_skip_render(bool skip);
 int get_display_scanlines();
 uint16_t get_background_color();
 uint16_t* get_display_output();
 
+//Pixel formats the final image can be written in, besides the RGB555 display output
+enum class OutputFormat
+{
+	ARGB8888,
+	RGB565
+};
+
+//Lends the renderer a buffer, such as a locked streaming texture, to write each line of the final image to as it's
+//drawn. It must stay valid until the next call, which can pass null pixels to stop writing to it.
+void set_output_target(void* pixels, int pitch, OutputFormat format);
+
+//Whether the last frame drawn differs from the one before it. Lines drawn with the same registers and VDP memory as
+//last time are reused, so an unchanged frame doesn't need to be uploaded or presented again.
+bool is_frame_changed();
+
+//Writes the whole display output to the output target, for frames that were drawn without one
+void copy_to_output_target();
+
+//CPU scalers for writing the final image to a host buffer larger than the display output
+enum class Scaler
+{
+	NEAREST,
+	SCALE2X,
+	SCALE3X,
+	SCANLINES
+};
+
+constexpr static int MAX_SCALE_FACTOR = 4;
+
+//How many times larger a scaler's output is than the display output. Nearest and scanlines scale by factor, clamped to
+//at most MAX_SCALE_FACTOR and at least 1 (2 for scanlines), while Scale2x and Scale3x always scale by 2 and 3.
+int get_scale_factor(Scaler scaler, int factor);
+
+//Writes the whole display output to pixels in a host format, scaled up by get_scale_factor(scaler, factor)
+void scale_display_output(void* pixels, int pitch, OutputFormat format, Scaler scaler, int factor);
+
+//Layer capture keeps a full-frame copy of every layer and screen for dump_all_bmps, at a cost to rendering speed
+void set_layer_capture(bool enable);
+bool get_layer_capture();
+
+//Draws visible lines on a worker thread, overlapping rendering with emulation until the next VSYNC
+void set_threaded_render(bool enable);
+bool get_threaded_render();
+
+//Draws whole frames at VSYNC in horizontal bands across this many threads, 0 to draw lines as they end
+//Frames that write VRAM, OAM or the palette mid-frame are drawn in order instead. Overrides threaded rendering.
+void set_deferred_render(int threads);
+int get_deferred_render();
+
 void dump_all_bmps(int image_type, fs::path base_path);	 //TEMP ADDED
 void dump_current_frame(int image_type, fs::path path);
-void dump_for_serial();
+
+//State dumps hold VRAM, OAM, the palette and the rendering registers as regions of halfword writes, which can be sent
+//to real hardware over serial. Loading one writes the regions back in order.
+void dump_for_serial(fs::path path = "emudump.bin");
+bool load_serial_dump(fs::path path);
+
+/*
+ * The write log records every register, palette, OAM and DMA write with the frame, VCOUNT line and beam X it happened
+ * at, to find which games change the VDP mid-frame. Writes during HBLANK are logged at X = DISPLAY_WIDTH, past the
+ * last pixel. It keeps the newest capacity writes in a ring buffer, and a capacity of 0 turns it off. Frames are
+ * counted from when the log was set up, each one starting at VSYNC.
+ */
+enum class WriteLogFormat
+{
+	CSV,
+	JSON
+};
+
+void set_write_log(int capacity);
+bool export_write_log(fs::path path, WriteLogFormat format);
 
 //TODO: should these MMIO accessors be moved to a different file?
+uint8_t bitmap_read8(uint32_t addr);
+uint16_t bitmap_read16(uint32_t addr);
+uint32_t bitmap_read32(uint32_t addr);
+
+void bitmap_write8(uint32_t addr, uint8_t value);
+void bitmap_write16(uint32_t addr, uint16_t value);
+void bitmap_write32(uint32_t addr, uint32_t value);
+
+uint8_t tile_read8(uint32_t addr);
+uint16_t tile_read16(uint32_t addr);
+uint32_t tile_read32(uint32_t addr);
+
+void tile_write8(uint32_t addr, uint8_t value);
+void tile_write16(uint32_t addr, uint16_t value);
+void tile_write32(uint32_t addr, uint32_t value);
+
 uint8_t palette_read8(uint32_t addr);
 uint16_t palette_read16(uint32_t addr);
 uint32_t palette_read32(uint32_t addr);